@@ -59,17 +59,6 @@ int		CLzhDepacker::DataIn(void *pBuffer,int nBytes)
 	return np;
 }
 
-int		CLzhDepacker::DataOut(void *pBuffer,int nBytes)
-{
-	const int np = (nBytes <= m_dstSize) ? nBytes : m_dstSize;
-	if (np > 0)
-	{
-		memcpy(m_pDst,pBuffer,np);
-		m_pDst += np;
-		m_dstSize -= np;
-	}
-	return np;
-}
 
 
 
@@ -411,31 +400,53 @@ void CLzhDepacker::decode (uint count, uchar buffer[])
     }
 }
 
-bool	CLzhDepacker::LzUnpack(void *pSrc,int srcSize,void *pDst,int dstSize)
+void	CLzhDepacker::LzOpen(void *pSrc,int srcSize,int dstSize)
 {
 
     with_error = 0;
 
 	m_pSrc = (uchar*)pSrc;
 	m_srcSize = srcSize;
-	m_pDst = (uchar*)pDst;
-	m_dstSize = dstSize;
+	m_dstLeft = dstSize;
+	m_outPos = 0;
+	m_outSize = 0;
 
     decode_start ();
+}
 
-	unsigned int origsize = dstSize;
-    while (origsize != 0)
-    {
-        int n = (uint) ((origsize > DICSIZ) ? DICSIZ : origsize);
-        decode (n, outbuf);
-		if (with_error)
-			break;
-
-		DataOut(outbuf,n);
-        origsize -= n;
-		if (with_error)
-			break;
-    }
+int		CLzhDepacker::LzRead(void *pDst,int nBytes)
+{
+	uchar *pOut = (uchar*)pDst;
+	int done = 0;
 
+	while (done < nBytes)
+	{
+		if (m_outPos == m_outSize)
+		{
+			// outbuf is the dictionary too, so decode whole DICSIZ blocks in it
+			if ((m_dstLeft == 0) || (with_error))
+				break;
+			const uint n = (m_dstLeft > DICSIZ) ? DICSIZ : m_dstLeft;
+			decode (n, outbuf);
+			if (with_error)
+				break;
+			m_dstLeft -= n;
+			m_outPos = 0;
+			m_outSize = n;
+		}
+		uint np = m_outSize - m_outPos;
+		if (np > (uint)(nBytes - done))
+			np = nBytes - done;
+		memcpy(pOut + done,outbuf + m_outPos,np);
+		m_outPos += np;
+		done += np;
+	}
+	return done;
+}
+
+bool	CLzhDepacker::LzUnpack(void *pSrc,int srcSize,void *pDst,int dstSize)
+{
+	LzOpen(pSrc,srcSize,dstSize);
+	LzRead(pDst,dstSize);
     return (0 == with_error);
 }
@@ -0,0 +1,694 @@
+/*
+ * convertym
+ * Copyright (C) 2024 Pat Deegan, https://psychogenic.com
+ *
+ * PSYM and pure python streaming writers, see PsymWriter.h
+ */
+
+#include "PsymWriter.h"
+#include <string.h>
+#include <sys/stat.h>
+#include <chrono>
+
+// room left in the python SongInfo for the sample count, patched on close
+#define PYTHON_NUM_WIDTH        20
+
+static uint64_t clockNs()
+{
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+CPsymWriter::CPsymWriter() : m_clockFreq(0), m_rateHz(0), m_numsamps(0),
+        m_seekable(false), m_waits(false), m_repeats(false), m_events(false), m_indexInterval(0),
+        m_loopStart(0), m_loopEnd(0), m_loopEndPosition(0), m_waiting(0),
+        m_file(NULL), m_memory(NULL), m_failed(false), m_offset(0), m_flushed(0),
+        m_writeNs(0), m_peakBuffer(0)
+{
+}
+
+CPsymWriter::~CPsymWriter()
+{
+        if (m_file && m_file != stdout) {
+                fclose(m_file);
+        }
+}
+
+bool CPsymWriter::open(const char * outfile, uint32_t clockFreq, uint8_t rateHz)
+{
+        if (std::string(outfile) == "-") {
+                m_file = stdout;
+        } else {
+                m_file = fopen(outfile, "wb");
+        }
+        if (! m_file) {
+                return false;
+        }
+
+        // only a regular file can be patched in place on close
+        struct stat st;
+        m_seekable = (fstat(fileno(m_file), &st) == 0) && S_ISREG(st.st_mode);
+        m_memory = NULL;
+        start(clockFreq, rateHz);
+        return true;
+}
+
+bool CPsymWriter::openMemory(std::vector<uint8_t> * out, uint32_t clockFreq, uint8_t rateHz)
+{
+        out->clear();
+        m_memory = out;
+        m_seekable = true;
+        start(clockFreq, rateHz);
+        return true;
+}
+
+bool CPsymWriter::openStream(uint32_t clockFreq, uint8_t rateHz)
+{
+        m_stream.clear();
+        m_memory = &m_stream;
+        m_seekable = false;
+        start(clockFreq, rateHz);
+        return true;
+}
+
+void CPsymWriter::take(std::vector<uint8_t> & bytes)
+{
+        if (m_memory == &m_stream) {
+                flush();
+        }
+        bytes.swap(m_stream);
+        m_stream.clear();
+}
+
+void CPsymWriter::start(uint32_t clockFreq, uint8_t rateHz)
+{
+        m_clockFreq = clockFreq;
+        m_rateHz = rateHz;
+        m_numsamps = 0;
+        m_waiting = 0;
+        memset(m_state, 0, sizeof(m_state));
+        m_keys.clear();
+        memset(&m_loopKey, 0, sizeof(m_loopKey));
+        m_loopEndPosition = 0;
+        m_failed = false;
+        m_offset = 0;
+        m_flushed = 0;
+        m_writeNs = 0;
+        m_peakBuffer = 0;
+        m_buffer.clear();
+        m_buffer.reserve(PSYM_BUFFER_SIZE);
+        writeHeader();
+}
+
+Keyframe CPsymWriter::keyframe(uint64_t frame) const
+{
+        Keyframe key;
+        key.frame = frame;
+        key.position = position();
+        memcpy(key.registers, m_state, sizeof(key.registers));
+        return key;
+}
+
+void CPsymWriter::frameStart()
+{
+        uint64_t frame = m_numsamps + m_waiting;
+        bool isKey = m_indexInterval && ! (frame % m_indexInterval);
+        bool isLoop = hasLoop() && (frame == m_loopStart || frame == m_loopEnd);
+        if (! isKey && ! isLoop) {
+                return;
+        }
+        // a keyframe or loop point can't land in the middle of a wait (or repeat)
+        flushWait();
+        flushEntries();
+        if (isKey) {
+                m_keys.push_back(keyframe(frame));
+        }
+        if (isLoop && frame == m_loopStart) {
+                m_loopKey = keyframe(frame);
+        } else if (isLoop) {
+                m_loopEndPosition = position();
+        }
+}
+
+void CPsymWriter::sample(const RegisterSettings & settings)
+{
+        frameStart();
+        flushWait();
+        for (uint8_t j=0; j<settings.num; j++) {
+                if (settings.values[j].reg < PSYM_KEY_REGISTERS) {
+                        m_state[settings.values[j].reg] = settings.values[j].val;
+                }
+        }
+        writeSample(settings);
+        m_numsamps++;
+        if (m_buffer.size() >= PSYM_BUFFER_SIZE) {
+                flush();
+        }
+}
+
+void CPsymWriter::wait()
+{
+        frameStart();
+        m_waiting++;
+}
+
+void CPsymWriter::flushWait()
+{
+        if (! m_waiting) {
+                return;
+        }
+        // NUMSAMPS counts frames, so a wait counts for all of its frames
+        writeWait(m_waiting);
+        m_numsamps += m_waiting;
+        m_waiting = 0;
+        if (m_buffer.size() >= PSYM_BUFFER_SIZE) {
+                flush();
+        }
+}
+
+void CPsymWriter::events(const RegisterEvent * events, std::size_t num)
+{
+        if (! num) {
+                return;
+        }
+        // the frame they're in has to end the entry before
+        flushWait();
+        for (std::size_t i=0; i<num; i++) {
+                if (events[i].reg < PSYM_KEY_REGISTERS) {
+                        m_state[events[i].reg] = events[i].val;
+                }
+        }
+        writeEvents(events, num);
+        if (m_buffer.size() >= PSYM_BUFFER_SIZE) {
+                flush();
+        }
+}
+
+bool CPsymWriter::close()
+{
+        if (! m_file && ! m_memory) {
+                return false;
+        }
+        flushWait();
+        if (hasLoop() && m_numsamps <= m_loopEnd) {
+                // no frame started the loop end, it's the end of the samples
+                flushEntries();
+                m_loopEndPosition = position();
+        }
+        writeEnd();
+        flush();
+        if (m_memory) {
+                m_memory = NULL;
+                return ! m_failed;
+        }
+        uint64_t start = clockNs();
+        if (m_file == stdout) {
+                if (fflush(m_file) != 0) {
+                        m_failed = true;
+                }
+        } else if (fclose(m_file) != 0) {
+                m_failed = true;
+        }
+        m_writeNs += clockNs() - start;
+        m_file = NULL;
+        return ! m_failed;
+}
+
+void CPsymWriter::put(uint8_t byte)
+{
+        m_buffer.push_back(byte);
+        m_offset++;
+}
+
+void CPsymWriter::put(const void * data, std::size_t len)
+{
+        const uint8_t * p = (const uint8_t *)data;
+        m_buffer.insert(m_buffer.end(), p, p + len);
+        m_offset += len;
+}
+
+void CPsymWriter::put(const char * str)
+{
+        put(str, strlen(str));
+}
+
+void CPsymWriter::putLittleEndian(uint64_t value, uint8_t numBytes)
+{
+        for (uint8_t i=0; i<numBytes; i++) {
+                put((uint8_t)(value >> (8*i)));
+        }
+}
+
+void CPsymWriter::patch(uint64_t offset, const void * data, std::size_t len)
+{
+        if (offset >= m_flushed) {
+                // still in the buffer
+                memcpy(&m_buffer[offset - m_flushed], data, len);
+                return;
+        }
+        flush();
+        if (m_memory) {
+                memcpy(&(*m_memory)[offset], data, len);
+                return;
+        }
+        uint64_t start = clockNs();
+        if (fseeko(m_file, offset, SEEK_SET) != 0
+                        || fwrite(data, 1, len, m_file) != len
+                        || fseeko(m_file, 0, SEEK_END) != 0) {
+                m_failed = true;
+        }
+        m_writeNs += clockNs() - start;
+}
+
+void CPsymWriter::patchNumSamples()
+{
+        // same place in every PSYM header, right after RATE
+        uint8_t numsamps[8];
+        for (uint8_t i=0; i<8; i++) {
+                numsamps[i] = (uint8_t)(m_numsamps >> (8*i));
+        }
+        patch(10, numsamps, sizeof(numsamps));
+}
+
+void CPsymWriter::flush()
+{
+        if (! m_buffer.size()) {
+                return;
+        }
+        if (m_buffer.size() > m_peakBuffer) {
+                m_peakBuffer = m_buffer.size();
+        }
+        uint64_t start = clockNs();
+        if (m_memory) {
+                m_memory->insert(m_memory->end(), m_buffer.begin(), m_buffer.end());
+        } else if (fwrite(m_buffer.data(), 1, m_buffer.size(), m_file) != m_buffer.size()) {
+                m_failed = true;
+        }
+        m_writeNs += clockNs() - start;
+        m_flushed += m_buffer.size();
+        m_buffer.clear();
+}
+
+
+void CPsym1Writer::writeHeader()
+{
+        put("PSYM1");
+        putLittleEndian(m_clockFreq, 4);
+        put(m_rateHz);
+        // patched or repeated in the trailer on close
+        putLittleEndian(PSYM_NUMSAMPS_UNKNOWN, 8);
+}
+
+void CPsym1Writer::writeSample(const RegisterSettings & settings)
+{
+        put(settings.num);
+        put(settings.values, settings.num * sizeof(RegisterValue));
+}
+
+void CPsym1Writer::writeWait(uint64_t count)
+{
+        while (count--) {
+                put((uint8_t)0);
+        }
+}
+
+void CPsym1Writer::writeEnd()
+{
+        if (m_seekable) {
+                patchNumSamples();
+        } else {
+                put(PSYM_END_MARKER);
+                putLittleEndian(m_numsamps, 8);
+        }
+}
+
+
+CPsym2Writer::CPsym2Writer() : m_historyBase(0), m_follows(false)
+{
+}
+
+void CPsym2Writer::writeHeader()
+{
+        m_pending.clear();
+        m_history.clear();
+        m_historyBase = 0;
+        m_head.assign(PSYM2_REPEAT_HASH, -1);
+        m_prev.assign(PSYM2_REPEAT_WINDOW, -1);
+        m_follows = false;
+
+        put("PSYM2");
+        putLittleEndian(m_clockFreq, 4);
+        put(m_rateHz);
+        putLittleEndian(PSYM_NUMSAMPS_UNKNOWN, 8);
+        put((uint8_t)((m_waits ? PSYM2_FLAG_WAIT : 0) | (m_indexInterval ? PSYM2_FLAG_INDEX : 0)
+                        | (m_repeats ? PSYM2_FLAG_REPEAT : 0) | (hasLoop() ? PSYM2_FLAG_LOOP : 0)
+                        | (m_events ? PSYM2_FLAG_EVENTS : 0)));
+        if (m_indexInterval) {
+                // INDEXOFFSET, patched or in the trailer on close
+                putLittleEndian(PSYM_NUMSAMPS_UNKNOWN, 8);
+        }
+        if (hasLoop()) {
+                // same, all ones until then
+                for (int i=0; i<PSYM2_LOOP_SIZE; i++) {
+                        put((uint8_t)0xff);
+                }
+        }
+}
+
+void CPsym2Writer::writeSample(const RegisterSettings & settings)
+{
+        uint8_t entry[PSYM2_ENTRY_MAX];
+        uint8_t num = 2;
+        uint16_t mask = 0;
+        for (uint8_t j=0; j<settings.num; j++) {
+                uint16_t bit = 1 << settings.values[j].reg;
+                if (bit & PSYM2_MASK_REGISTERS) {
+                        mask |= bit;
+                        entry[num++] = settings.values[j].val;
+                }
+        }
+        entry[0] = (uint8_t)mask;
+        entry[1] = (uint8_t)(mask >> 8);
+        putEntry(entry, num);
+}
+
+void CPsym2Writer::writeWait(uint64_t count)
+{
+        while (count) {
+                uint8_t run = count > PSYM2_WAIT_MAX ? PSYM2_WAIT_MAX : count;
+                uint8_t entry[3] = {0, 0, run};
+                putEntry(entry, sizeof(entry));
+                count -= run;
+        }
+}
+
+void CPsym2Writer::writeEvents(const RegisterEvent * events, std::size_t num)
+{
+        // too big to be held back for repeats, and never part of one
+        flushEntries();
+        m_follows = false;
+        while (num) {
+                std::size_t run = num > PSYM2_EVENTS_MAX ? PSYM2_EVENTS_MAX : num;
+                putLittleEndian(PSYM2_EVENTS_BIT | run, 2);
+                for (std::size_t i=0; i<run; i++) {
+                        putLittleEndian(events[i].time, 2);
+                        put(events[i].reg);
+                        put(events[i].val);
+                }
+                events += run;
+                num -= run;
+        }
+}
+
+void CPsym2Writer::putEntry(const uint8_t * bytes, uint8_t len)
+{
+        if (! m_repeats) {
+                put(bytes, len);
+                return;
+        }
+        Psym2Entry entry;
+        entry.len = len;
+        memcpy(entry.bytes, bytes, len);
+        m_pending.push_back(entry);
+        if (m_pending.size() >= PSYM2_REPEAT_MAX) {
+                encodeEntry();
+        }
+}
+
+void CPsym2Writer::flushEntries()
+{
+        while (m_pending.size()) {
+                encodeEntry();
+        }
+}
+
+static uint32_t entryHash(const Psym2Entry & entry)
+{
+        uint32_t hash = 2166136261u;
+        for (uint8_t i=0; i<entry.len; i++) {
+                hash = (hash ^ entry.bytes[i]) * 16777619u;
+        }
+        return hash % PSYM2_REPEAT_HASH;
+}
+
+static bool sameEntry(const Psym2Entry & a, const Psym2Entry & b)
+{
+        return a.len == b.len && memcmp(a.bytes, b.bytes, a.len) == 0;
+}
+
+uint8_t CPsym2Writer::findRepeat(uint64_t * start)
+{
+        uint8_t best = 0;
+        uint32_t bestBytes = PSYM2_REPEAT_SIZE;         // has to save something
+        const uint64_t end = m_historyBase + m_history.size();
+        int tries = PSYM2_REPEAT_CHAIN;
+        for (int64_t j = m_head[entryHash(m_pending[0])];
+                        j >= (int64_t)m_historyBase && tries--;
+                        j = m_prev[j % PSYM2_REPEAT_WINDOW]) {
+                uint32_t bytes = 0;
+                std::size_t len = 0;
+                while (len < PSYM2_REPEAT_MAX && len < m_pending.size() && j + len < end) {
+                        const Psym2Entry & earlier = m_history[j + len - m_historyBase];
+                        // what's repeated has to be contiguous in the file
+                        if ((len && ! earlier.follows) || ! sameEntry(earlier, m_pending[len])) {
+                                break;
+                        }
+                        bytes += earlier.len;
+                        len++;
+                }
+                if (bytes > bestBytes) {
+                        bestBytes = bytes;
+                        best = len;
+                        *start = m_history[j - m_historyBase].offset;
+                }
+        }
+        return best;
+}
+
+void CPsym2Writer::encodeEntry()
+{
+        uint64_t start = 0;
+        uint8_t len = findRepeat(&start);
+        if (len) {
+                putLittleEndian(0, 2);
+                put((uint8_t)0);
+                putLittleEndian(start, 4);
+                put(len);
+                m_pending.erase(m_pending.begin(), m_pending.begin() + len);
+                m_follows = false;
+                return;
+        }
+        Psym2Entry & entry = m_pending.front();
+        entry.offset = bytesOut();
+        entry.follows = m_follows;
+        put(entry.bytes, entry.len);
+        m_follows = true;
+        addHistory(entry);
+        m_pending.pop_front();
+}
+
+void CPsym2Writer::addHistory(Psym2Entry & entry)
+{
+        uint64_t number = m_historyBase + m_history.size();
+        uint32_t hash = entryHash(entry);
+        m_prev[number % PSYM2_REPEAT_WINDOW] = m_head[hash];
+        m_head[hash] = number;
+        m_history.push_back(entry);
+        if (m_history.size() > PSYM2_REPEAT_WINDOW) {
+                m_history.pop_front();
+                m_historyBase++;
+        }
+}
+
+uint64_t CPsym2Writer::loopInfoOffset() const
+{
+        return m_indexInterval ? 27 : 19;
+}
+
+void CPsym2Writer::loopInfo(uint8_t * info) const
+{
+        uint32_t fields[3] = {(uint32_t)m_loopKey.frame, (uint32_t)m_loopKey.position,
+                        (uint32_t)m_loopEndPosition};
+        for (int f=0; f<3; f++) {
+                for (int i=0; i<4; i++) {
+                        *info++ = (uint8_t)(fields[f] >> (8*i));
+                }
+        }
+        memcpy(info, m_loopKey.registers, PSYM_KEY_REGISTERS);
+}
+
+void CPsym2Writer::writeEnd()
+{
+        flushEntries();
+        if (m_seekable) {
+                patchNumSamples();
+        } else {
+                putLittleEndian(PSYM2_END_MARKER, 2);
+                putLittleEndian(m_numsamps, 8);
+        }
+        uint64_t indexOffset = bytesOut();
+        if (m_indexInterval) {
+                if (m_seekable) {
+                        uint8_t offset[8];
+                        for (uint8_t i=0; i<8; i++) {
+                                offset[i] = (uint8_t)(indexOffset >> (8*i));
+                        }
+                        patch(19, offset, sizeof(offset));
+                } else {
+                        indexOffset += 8 + (hasLoop() ? PSYM2_LOOP_SIZE : 0);
+                        putLittleEndian(indexOffset, 8);
+                }
+        }
+        if (hasLoop()) {
+                uint8_t info[PSYM2_LOOP_SIZE];
+                loopInfo(info);
+                if (m_seekable) {
+                        patch(loopInfoOffset(), info, sizeof(info));
+                } else {
+                        put(info, sizeof(info));
+                }
+        }
+        if (m_indexInterval) {
+                writeIndex();
+        }
+}
+
+void CPsym2Writer::writeIndex()
+{
+        putLittleEndian(m_indexInterval, 4);
+        putLittleEndian(m_keys.size(), 4);
+        for (const Keyframe & key : m_keys) {
+                putLittleEndian(key.frame, 4);
+                putLittleEndian(key.position, 4);
+                put(key.registers, sizeof(key.registers));
+        }
+}
+
+
+void CPythonWriter::putSongInfo(bool padded)
+{
+        char info[128];
+        snprintf(info, sizeof(info), "SongInfo = {'clock': %u, 'rate': %d, 'num': ",
+                        (unsigned)m_clockFreq, (int)m_rateHz);
+        put(info);
+        if (padded) {
+                m_numOffset = bytesOut();
+                put("                    ", PYTHON_NUM_WIDTH);
+        } else {
+                snprintf(info, sizeof(info), "%llu", (unsigned long long)m_numsamps);
+                put(info);
+        }
+        if (m_waits) {
+                put(", 'wait': True");
+        }
+        if (m_indexInterval) {
+                snprintf(info, sizeof(info), ", 'index': %u", (unsigned)m_indexInterval);
+                put(info);
+        }
+        if (hasLoop()) {
+                put(", 'loop': True");
+        }
+        if (m_events) {
+                put(", 'events': True");
+        }
+        put("}\n");
+}
+
+void CPythonWriter::writeHeader()
+{
+        m_lineCount = 0;
+        m_entries = 0;
+        if (m_seekable) {
+                putSongInfo(true);
+        }
+        put("Song = [\n");
+}
+
+void CPythonWriter::writeSample(const RegisterSettings & settings)
+{
+        char pair[16];
+        if (! m_lineCount) {
+                put("\t");
+        }
+        put("[");
+        for (uint8_t j=0; j<settings.num; j++) {
+                int len = snprintf(pair, sizeof(pair), j ? ",(%d,%d)" : "(%d,%d)",
+                                (int)settings.values[j].reg, (int)settings.values[j].val);
+                put(pair, len);
+                m_lineCount ++;
+        }
+        put("],");
+        m_entries++;
+        if (m_lineCount > 10) {
+                m_lineCount = 0;
+                put("\n");
+        }
+}
+
+void CPythonWriter::writeWait(uint64_t count)
+{
+        char wait[32];
+        if (! m_lineCount) {
+                put("\t");
+        }
+        put(wait, snprintf(wait, sizeof(wait), "%llu,", (unsigned long long)count));
+        m_entries++;
+        if (++m_lineCount > 10) {
+                m_lineCount = 0;
+                put("\n");
+        }
+}
+
+void CPythonWriter::writeEvents(const RegisterEvent * events, std::size_t num)
+{
+        char event[32];
+        if (! m_lineCount) {
+                put("\t");
+        }
+        put("(");
+        for (std::size_t i=0; i<num; i++) {
+                put(event, snprintf(event, sizeof(event), "(%d,%d,%d),",
+                                (int)events[i].time, (int)events[i].reg, (int)events[i].val));
+        }
+        put("),");
+        m_entries++;
+        m_lineCount = 0;
+        put("\n");
+}
+
+void CPythonWriter::writeEnd()
+{
+        put("]\n");
+        if (m_seekable) {
+                char num[PYTHON_NUM_WIDTH + 1];
+                int len = snprintf(num, sizeof(num), "%llu", (unsigned long long)m_numsamps);
+                patch(m_numOffset, num, len);
+        } else {
+                // can't go back to the top, python doesn't mind it at the end
+                putSongInfo(false);
+        }
+        char line[128];
+        if (hasLoop()) {
+                put(line, snprintf(line, sizeof(line), "SongLoop = (%llu,%llu,%llu,(",
+                                (unsigned long long)m_loopKey.frame, (unsigned long long)m_loopKey.position,
+                                (unsigned long long)m_loopEndPosition));
+                for (uint8_t i=0; i<PSYM_KEY_REGISTERS; i++) {
+                        put(line, snprintf(line, sizeof(line), i ? ",%d" : "%d", (int)m_loopKey.registers[i]));
+                }
+                put("))\n");
+        }
+        if (! m_indexInterval) {
+                return;
+        }
+        put("SongIndex = [\n");
+        for (const Keyframe & key : m_keys) {
+                put(line, snprintf(line, sizeof(line), "\t(%llu,%llu,(", 
+                                (unsigned long long)key.frame, (unsigned long long)key.position));
+                for (uint8_t i=0; i<PSYM_KEY_REGISTERS; i++) {
+                        put(line, snprintf(line, sizeof(line), i ? ",%d" : "%d", (int)key.registers[i]));
+                }
+                put(")),\n");
+        }
+        put("]\n");
+}
@@ -0,0 +1,296 @@
+/*
+ * convertym
+ * Copyright (C) 2024 Pat Deegan, https://psychogenic.com
+ *
+ * Output side of convertym: the PSYM1, PSYM2 and pure python writers.
+ *
+ * Writers are streaming: samples are appended to one big buffer
+ * that is flushed to the file whenever it fills up, so memory use
+ * does not depend on the length of the song.  Whatever the header
+ * can only know at the end (the number of samples) is patched in
+ * place on close when the output is a regular file.  Pipes (or "-"
+ * for stdout) can't seek, so that information goes in a trailer
+ * instead, see the format description in the README.
+ *
+ * One writer can be reused for many files, the buffer is kept.
+ */
+
+#ifndef __PSYMWRITER__
+#define __PSYMWRITER__
+
+#include "YmTypes.h"
+#include <stdio.h>
+#include <vector>
+#include <deque>
+#include <string>
+
+// flush the output buffer, to the file, every time it gets that big
+#define PSYM_BUFFER_SIZE        (1024*1024)
+
+// NUMSAMPS in the header of an output we can't seek back into
+#define PSYM_NUMSAMPS_UNKNOWN   0xffffffffffffffffULL
+// NUMREGSETTINGS value marking the end of the samples, trailer follows
+#define PSYM_END_MARKER         0xff
+
+// PSYM2 frame masks: bit N set when register N follows.  The two
+// I/O port registers are never played, their bits are reserved
+#define PSYM2_MASK_REGISTERS    0x3fff
+#define PSYM2_END_MARKER        0xffff
+// a MASK of 0 is a wait, followed by a COUNT (1 byte) of unchanged frames
+#define PSYM2_WAIT_MAX          255
+
+// with repeats, a wait of COUNT 0 is a repeat: OFFSET (4) of earlier
+// entries in the file, ENTRIES (1) to play from there
+#define PSYM2_REPEAT_SIZE       8
+#define PSYM2_REPEAT_MAX        255
+// earlier entries a repeat is looked for in, and how many of them at most
+#define PSYM2_REPEAT_WINDOW     16384
+#define PSYM2_REPEAT_CHAIN      32
+#define PSYM2_REPEAT_HASH       4096
+// the longest entry, MASK and all 14 values
+#define PSYM2_ENTRY_MAX         16
+
+// PSYM2 FLAGS
+#define PSYM2_FLAG_WAIT         0x01
+#define PSYM2_FLAG_INDEX        0x02    // INDEXOFFSET (8) follows FLAGS
+#define PSYM2_FLAG_REPEAT       0x04
+#define PSYM2_FLAG_LOOP         0x08    // LOOPFRAME (4) LOOPOFFSET (4) LOOPEND (4) REGS (14) follow
+#define PSYM2_LOOP_SIZE         26
+#define PSYM2_FLAG_EVENTS       0x10
+
+// with events, a MASK of bit 15 and NUM (1 to PSYM2_EVENTS_MAX) in its low
+// bits is followed by NUM times TIME (2, us into the frame) REG (1) VALUE (1).
+// A frame longer than TIME can say (a player rate under 16Hz) has its later
+// writes at PSYM2_EVENTS_TIME_MAX, still in order.
+#define PSYM2_EVENTS_BIT        0x8000
+#define PSYM2_EVENTS_MAX        0x3fff
+#define PSYM2_EVENTS_TIME_MAX   0xffff
+
+// registers in a keyframe snapshot, the ones the player writes
+#define PSYM_KEY_REGISTERS      14
+
+typedef struct {
+    uint8_t reg;
+    uint8_t val;
+} RegisterValue;
+
+// what a sample sets, in register order
+typedef struct {
+    uint8_t num;
+    RegisterValue values[YMNUMREGISTERS];
+
+} RegisterSettings;
+
+// a write within a frame, rather than at its start
+typedef struct {
+    uint16_t time;              // us after the frame started
+    uint8_t reg;
+    uint8_t val;
+} RegisterEvent;
+
+// the state to restore before playing from frame on
+typedef struct {
+    uint64_t frame;
+    uint64_t position;          // where that frame's entry starts
+    uint8_t registers[PSYM_KEY_REGISTERS];
+} Keyframe;
+
+
+class CPsymWriter
+{
+public:
+        CPsymWriter();
+        virtual ~CPsymWriter();
+
+        // outfile "-" is stdout
+        bool open(const char * outfile, uint32_t clockFreq, uint8_t rateHz);
+        // or into *out, whole once close() returns, as a file would be
+        bool openMemory(std::vector<uint8_t> * out, uint32_t clockFreq, uint8_t rateHz);
+        // or as a pipe would get it, a piece at a time through take()
+        bool openStream(uint32_t clockFreq, uint8_t rateHz);
+        // openStream(): what was output since the last take(), into bytes
+        void take(std::vector<uint8_t> & bytes);
+        void sample(const RegisterSettings & settings);
+        // a frame where nothing changes, runs of them are written as one wait
+        void wait();
+        // writes during the frame just given to sample() or wait()
+        void events(const RegisterEvent * events, std::size_t num);
+        bool close();
+
+        // set before open()
+        void setWaits(bool on) { m_waits = on; }
+        // a keyframe every interval frames, 0 for no index
+        void setIndex(uint32_t interval) { m_indexInterval = interval; }
+        // back references to runs of earlier entries, where the format has them
+        void setRepeats(bool on) { m_repeats = on; }
+        // whether there will be events(), where the format has them
+        void setEvents(bool on) { m_events = on; }
+        // for the next file: frames start to end (the frame after the last one
+        // played) loop, start == end for no loop
+        void setLoop(uint64_t start, uint64_t end) { m_loopStart = start; m_loopEnd = end; }
+
+        uint64_t numSamples() const { return m_numsamps; }
+        uint64_t bytesOut() const { return m_offset; }
+        // since open(): time spent writing to the file, and the most it had buffered
+        uint64_t writeTime() const { return m_writeNs; }
+        uint64_t peakBuffer() const { return m_peakBuffer; }
+
+protected:
+        virtual void writeHeader() = 0;
+        virtual void writeSample(const RegisterSettings & settings) = 0;
+        virtual void writeWait(uint64_t count) = 0;
+        // formats without events just drop them
+        virtual void writeEvents(const RegisterEvent *, std::size_t) {}
+        // keyframe positions are in bytes, unless the format says otherwise
+        virtual uint64_t position() const { return m_offset; }
+        // write out whatever is held back, position() is about to be taken
+        virtual void flushEntries() {}
+        // write or patch in whatever was only known at the end
+        virtual void writeEnd() = 0;
+
+        void put(uint8_t byte);
+        void put(const void * data, std::size_t len);
+        void put(const char * str);
+        void putLittleEndian(uint64_t value, uint8_t numBytes);
+        // overwrite already written bytes, only if m_seekable
+        void patch(uint64_t offset, const void * data, std::size_t len);
+        void patchNumSamples();
+        void flush();
+        bool hasLoop() const { return m_loopEnd > m_loopStart; }
+        Keyframe keyframe(uint64_t frame) const;
+
+        uint32_t m_clockFreq;
+        uint8_t m_rateHz;
+        uint64_t m_numsamps;
+        bool m_seekable;
+        bool m_waits;
+        bool m_repeats;
+        bool m_events;
+        uint32_t m_indexInterval;
+        std::vector<Keyframe> m_keys;
+        uint64_t m_loopStart;
+        uint64_t m_loopEnd;
+        Keyframe m_loopKey;             // the state to restore on looping
+        uint64_t m_loopEndPosition;     // where the entry starting m_loopEnd is
+
+private:
+        void start(uint32_t clockFreq, uint8_t rateHz);
+        void flushWait();
+        void frameStart();
+
+        uint64_t m_waiting;             // unchanged frames not written yet
+        uint8_t m_state[PSYM_KEY_REGISTERS];    // as the player will have it
+        FILE * m_file;
+        std::vector<uint8_t> * m_memory;        // openMemory() output, m_file is NULL then
+        std::vector<uint8_t> m_stream;          // openStream() output not taken yet
+        bool m_failed;
+        uint64_t m_offset;              // bytes output so far, buffered ones included
+        uint64_t m_flushed;             // of which are in the file already
+        std::vector<uint8_t> m_buffer;
+        uint64_t m_writeNs;             // a clock read per flush, not per sample
+        uint64_t m_peakBuffer;
+};
+
+
+/*
+ * PSYM1 (see README):
+ *  "PSYM1", CLOCKFREQ (4), SAMPLERATEHz (1), NUMSAMPS (8)
+ *  then NUMSAMPS times NUMREGSETTINGS (1) + REGISTER,VALUE pairs
+ * It has no wait, each unchanged frame is an empty sample.
+ */
+class CPsym1Writer : public CPsymWriter
+{
+protected:
+        virtual void writeHeader();
+        virtual void writeSample(const RegisterSettings & settings);
+        virtual void writeWait(uint64_t count);
+        virtual void writeEnd();
+};
+
+
+/*
+ * PSYM2 (see README):
+ *  "PSYM2", CLOCKFREQ (4), SAMPLERATEHz (1), NUMSAMPS (8), FLAGS (1)
+ *  then NUMSAMPS times MASK (2) + one VALUE (1) per set bit, lowest first
+ *  or, with waits, MASK 0 + COUNT (1) for COUNT unchanged frames
+ *  and, with an index, INDEXOFFSET (8) after FLAGS pointing to
+ *  INTERVAL (4), NUMKEYS (4), NUMKEYS times FRAME (4) OFFSET (4) REGS (14)
+ *  and, with repeats, MASK 0 + COUNT 0 + OFFSET (4) + ENTRIES (1) to
+ *  play ENTRIES entries (none of them a repeat) from OFFSET in the file
+ *  and, with a loop, LOOPFRAME (4), LOOPOFFSET (4), LOOPEND (4), REGS (14)
+ *  after INDEXOFFSET, if any: on getting to LOOPEND, restore REGS and
+ *  carry on from LOOPOFFSET
+ *  and, with events, events entries (see PSYM2_EVENTS_BIT) for writes
+ *  within the last frame of the entry before them, never repeated
+ *
+ * Repeats are found greedily: entries are held back until there are
+ * PSYM2_REPEAT_MAX of them, then the first goes out as the longest run
+ * of earlier plain entries it starts, if that saves anything, else as is.
+ */
+typedef struct {
+    uint8_t len;
+    uint8_t bytes[PSYM2_ENTRY_MAX];
+    bool follows;               // right after the previous entry in the file
+    uint64_t offset;
+} Psym2Entry;
+
+class CPsym2Writer : public CPsymWriter
+{
+public:
+        CPsym2Writer();
+
+protected:
+        virtual void writeHeader();
+        virtual void writeSample(const RegisterSettings & settings);
+        virtual void writeWait(uint64_t count);
+        virtual void writeEvents(const RegisterEvent * events, std::size_t num);
+        virtual void flushEntries();
+        virtual void writeEnd();
+
+private:
+        void writeIndex();
+        uint64_t loopInfoOffset() const;
+        void loopInfo(uint8_t * info) const;
+        void putEntry(const uint8_t * bytes, uint8_t len);
+        // the first pending entry, or a repeat of it and those after
+        void encodeEntry();
+        uint8_t findRepeat(uint64_t * start);
+        void addHistory(Psym2Entry & entry);
+
+        std::deque<Psym2Entry> m_pending;
+        std::deque<Psym2Entry> m_history;       // the last plain entries written
+        uint64_t m_historyBase;                 // number of the first of them
+        std::vector<int64_t> m_head;            // latest entry number with a hash
+        std::vector<int64_t> m_prev;            // by number % window, the one before
+        bool m_follows;
+};
+
+
+/*
+ * Pure python: a SongInfo dict and a Song list of samples, each
+ * a list of (REG, VAL) tuples, or with waits an int for that many
+ * unchanged frames.  With an index, a SongIndex list of (frame, Song
+ * entry, registers) keyframes follows.  With events, a tuple of
+ * (us, REG, VAL) is the writes within the last frame of the entry before.
+ */
+class CPythonWriter : public CPsymWriter
+{
+public:
+        CPythonWriter() : m_numOffset(0), m_entries(0), m_lineCount(0) {}
+
+protected:
+        virtual void writeHeader();
+        virtual void writeSample(const RegisterSettings & settings);
+        virtual void writeWait(uint64_t count);
+        virtual void writeEvents(const RegisterEvent * events, std::size_t num);
+        virtual uint64_t position() const { return m_entries; }
+        virtual void writeEnd();
+
+private:
+        void putSongInfo(bool padded);
+        uint64_t m_numOffset;
+        uint64_t m_entries;
+        uint8_t m_lineCount;
+};
+
+#endif
@@ -0,0 +1,304 @@
+/*
+ * convertym
+ * Copyright (C) 2024 Pat Deegan, https://psychogenic.com
+ *
+ * convertym --serve request parsing and reply helpers, see Serve.h
+ */
+
+#include "Serve.h"
+#include <stdio.h>
+#include <string.h>
+
+namespace {
+
+class JsonReader
+{
+public:
+        JsonReader(const std::string & text) : m_text(text), m_pos(0) {}
+
+        void skipSpace() {
+                while (m_pos < m_text.size() && strchr(" \t\r\n", m_text[m_pos])) {
+                        m_pos++;
+                }
+        }
+        // skips spaces, then c if it's next
+        bool accept(char c) {
+                skipSpace();
+                if (m_pos < m_text.size() && m_text[m_pos] == c) {
+                        m_pos++;
+                        return true;
+                }
+                return false;
+        }
+        bool atEnd() {
+                skipSpace();
+                return m_pos == m_text.size();
+        }
+        bool string(std::string & out);
+        // a string, number, true, false or null, as it is written
+        bool scalar(std::string & raw);
+        bool stringArray(std::vector<std::string> & out);
+
+private:
+        bool hex4(uint32_t & value);
+        void putUtf8(std::string & out, uint32_t code);
+
+        const std::string & m_text;
+        std::size_t m_pos;
+};
+
+bool JsonReader::hex4(uint32_t & value)
+{
+        if (m_pos + 4 > m_text.size()) {
+                return false;
+        }
+        value = 0;
+        for (int i=0; i<4; i++) {
+                char c = m_text[m_pos++];
+                int digit = (c >= '0' && c <= '9') ? c - '0'
+                          : (c >= 'a' && c <= 'f') ? c - 'a' + 10
+                          : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+                if (digit < 0) {
+                        return false;
+                }
+                value = (value << 4) | digit;
+        }
+        return true;
+}
+
+void JsonReader::putUtf8(std::string & out, uint32_t code)
+{
+        if (code < 0x80) {
+                out += (char)code;
+        } else if (code < 0x800) {
+                out += (char)(0xc0 | (code >> 6));
+                out += (char)(0x80 | (code & 0x3f));
+        } else if (code < 0x10000) {
+                out += (char)(0xe0 | (code >> 12));
+                out += (char)(0x80 | ((code >> 6) & 0x3f));
+                out += (char)(0x80 | (code & 0x3f));
+        } else {
+                out += (char)(0xf0 | (code >> 18));
+                out += (char)(0x80 | ((code >> 12) & 0x3f));
+                out += (char)(0x80 | ((code >> 6) & 0x3f));
+                out += (char)(0x80 | (code & 0x3f));
+        }
+}
+
+bool JsonReader::string(std::string & out)
+{
+        if (! accept('"')) {
+                return false;
+        }
+        out.clear();
+        while (m_pos < m_text.size()) {
+                char c = m_text[m_pos++];
+                if (c == '"') {
+                        return true;
+                }
+                if (c != '\\') {
+                        out += c;
+                        continue;
+                }
+                if (m_pos == m_text.size()) {
+                        return false;
+                }
+                c = m_text[m_pos++];
+                switch (c) {
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u': {
+                        uint32_t code;
+                        if (! hex4(code)) {
+                                return false;
+                        }
+                        uint32_t low;
+                        if (code >= 0xd800 && code < 0xdc00 && m_text.compare(m_pos, 2, "\\u") == 0) {
+                                m_pos += 2;
+                                if (! hex4(low) || low < 0xdc00 || low >= 0xe000) {
+                                        return false;
+                                }
+                                code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                        }
+                        putUtf8(out, code);
+                        break;
+                }
+                default:
+                        out += c;       // \" \\ \/
+                }
+        }
+        return false;
+}
+
+bool JsonReader::scalar(std::string & raw)
+{
+        skipSpace();
+        std::size_t start = m_pos;
+        if (m_pos < m_text.size() && m_text[m_pos] == '"') {
+                std::string unused;
+                if (! string(unused)) {
+                        return false;
+                }
+        } else {
+                while (m_pos < m_text.size() && strchr("+-.0123456789eEtruefalsn", m_text[m_pos])) {
+                        m_pos++;
+                }
+                if (m_pos == start) {
+                        return false;
+                }
+        }
+        raw = m_text.substr(start, m_pos - start);
+        return true;
+}
+
+bool JsonReader::stringArray(std::vector<std::string> & out)
+{
+        out.clear();
+        if (! accept('[')) {
+                return false;
+        }
+        if (accept(']')) {
+                return true;
+        }
+        do {
+                std::string item;
+                if (! string(item)) {
+                        return false;
+                }
+                out.push_back(item);
+        } while (accept(','));
+        return accept(']');
+}
+
+const char BASE64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+} // namespace
+
+
+bool parseServeRequest(const std::string & line, ServeRequest & request, std::string & error)
+{
+        request.id = "null";
+        request.in.clear();
+        request.data.clear();
+        request.hasData = false;
+        request.out.clear();
+        request.args.clear();
+
+        JsonReader json(line);
+        if (! json.accept('{')) {
+                error = "a request is a JSON object";
+                return false;
+        }
+        if (! json.accept('}')) {
+                do {
+                        std::string key;
+                        if (! json.string(key) || ! json.accept(':')) {
+                                error = "bad JSON";
+                                return false;
+                        }
+                        bool ok;
+                        if (key == "id") {
+                                ok = json.scalar(request.id);
+                        } else if (key == "in") {
+                                ok = json.string(request.in);
+                        } else if (key == "out") {
+                                ok = json.string(request.out);
+                        } else if (key == "data") {
+                                std::string text;
+                                ok = json.string(text) && base64Decode(text, request.data);
+                                request.hasData = true;
+                        } else if (key == "args") {
+                                ok = json.stringArray(request.args);
+                        } else {
+                                error = "unknown key " + key;
+                                return false;
+                        }
+                        if (! ok) {
+                                error = "bad value for " + key;
+                                return false;
+                        }
+                } while (json.accept(','));
+                if (! json.accept('}')) {
+                        error = "bad JSON";
+                        return false;
+                }
+        }
+        if (! json.atEnd()) {
+                error = "one request per line";
+                return false;
+        }
+        if (request.in.empty() == ! request.hasData) {
+                error = "a request needs one of in or data";
+                return false;
+        }
+        return true;
+}
+
+std::string base64Encode(const uint8_t * data, std::size_t size)
+{
+        std::string text;
+        text.reserve((size + 2) / 3 * 4);
+        for (std::size_t i=0; i<size; i += 3) {
+                uint32_t group = data[i] << 16;
+                if (i + 1 < size) {
+                        group |= data[i+1] << 8;
+                }
+                if (i + 2 < size) {
+                        group |= data[i+2];
+                }
+                text += BASE64[group >> 18];
+                text += BASE64[(group >> 12) & 63];
+                text += (i + 1 < size) ? BASE64[(group >> 6) & 63] : '=';
+                text += (i + 2 < size) ? BASE64[group & 63] : '=';
+        }
+        return text;
+}
+
+bool base64Decode(const std::string & text, std::vector<uint8_t> & data)
+{
+        data.clear();
+        data.reserve(text.size() / 4 * 3);
+        uint32_t group = 0;
+        int bits = 0;
+        std::size_t i = 0;
+        for (; i<text.size() && text[i] != '='; i++) {
+                const char * p = strchr(BASE64, text[i]);
+                if (! p || ! text[i]) {
+                        return false;
+                }
+                group = (group << 6) | (p - BASE64);
+                bits += 6;
+                if (bits >= 8) {
+                        bits -= 8;
+                        data.push_back((uint8_t)(group >> bits));
+                }
+        }
+        // nothing but padding after
+        for (; i<text.size(); i++) {
+                if (text[i] != '=') {
+                        return false;
+                }
+        }
+        return true;
+}
+
+std::string jsonString(const std::string & text)
+{
+        std::string out = "\"";
+        for (unsigned char c : text) {
+                if (c == '"' || c == '\\') {
+                        out += '\\';
+                        out += c;
+                } else if (c < 0x20) {
+                        char escaped[8];
+                        snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                        out += escaped;
+                } else {
+                        out += c;
+                }
+        }
+        return out + "\"";
+}
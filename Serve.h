@@ -0,0 +1,42 @@
+/*
+ * convertym
+ * Copyright (C) 2024 Pat Deegan, https://psychogenic.com
+ *
+ * convertym --serve requests and replies: one JSON object per line each
+ * way, e.g.
+ *   {"id": 1, "in": "songs/a.ym", "out": "out/a.psym", "args": ["-f", "psym2"]}
+ *   {"id": 2, "data": "<base64 YM file>", "args": ["--wait"]}
+ * and back
+ *   {"id": 1, "ok": true, "out": "out/a.psym", "samples": 3646, "stats": {...}}
+ *   {"id": 2, "ok": true, "data": "<base64 PSYM>", "samples": 812, "stats": {...}}
+ *   {"id": 3, "ok": false, "error": "File not Found"}
+ * Only what those take is parsed: objects, strings, numbers, true, false,
+ * null and arrays of strings; anything else in a request is an error.
+ */
+
+#ifndef __SERVE__
+#define __SERVE__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+typedef struct {
+    std::string id;                     // as it was in the request (JSON), "null" if none
+    std::string in;                     // song file, or
+    std::vector<uint8_t> data;          // the song itself, when hasData
+    bool hasData;
+    std::string out;                    // output file, empty to get it in the reply
+    std::vector<std::string> args;      // command line options, as for a single file
+} ServeRequest;
+
+// false, with why in error, if line isn't a request; the id is kept if it got that far
+bool parseServeRequest(const std::string & line, ServeRequest & request, std::string & error);
+
+std::string base64Encode(const uint8_t * data, std::size_t size);
+bool base64Decode(const std::string & text, std::vector<uint8_t> & data);
+
+// text as a JSON string, quotes included
+std::string jsonString(const std::string & text);
+
+#endif
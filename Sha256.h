@@ -0,0 +1,35 @@
+/*
+ * convertym
+ * Copyright (C) 2024 Pat Deegan, https://psychogenic.com
+ *
+ * SHA-256 (FIPS 180-4), what --cache keys and checks its entries on: the
+ * songs it is given may come from any --serve client, so the hash has to
+ * hold against crafted collisions, not only chance ones.
+ */
+
+#ifndef __SHA256__
+#define __SHA256__
+
+#include <stdint.h>
+#include <string>
+
+class CSha256
+{
+public:
+        CSha256();
+
+        // more of the message
+        void update(const void * data, std::size_t size);
+        // the digest of all of it, as 64 lowercase hex digits; once only
+        std::string hex();
+
+private:
+        void block(const uint8_t * p);
+
+        uint32_t m_state[8];
+        uint8_t m_buffer[64];
+        std::size_t m_buffered;
+        uint64_t m_length;              // bytes so far
+};
+
+#endif
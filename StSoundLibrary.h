@@ -53,6 +53,18 @@ typedef struct
 	yms32		musicTimeInMs;
 } ymMusicInfo_t;
 
+// Where the time goes, added to by every load (and ymMusicWaveCreate) of a
+// music it is set on with ymMusicSetStats().  Nothing is timed without one.
+typedef struct
+{
+	uint64_t	readNs;			// file mapped or read, or memory block copied
+	uint64_t	depackNs;		// LH5, frames depacked as a packed song streams included
+	uint64_t	decodeNs;		// YM header, drums, samples (deInterleave not included)
+	uint64_t	deInterleaveNs;
+	uint64_t	writeNs;		// WAV file writes
+	uint64_t	peakBuffer;		// biggest WAV block, in bytes
+} ymStats_t;
+
 
 
 #ifdef __cplusplus
@@ -60,26 +72,30 @@ extern "C"
 {
 #endif
 
-extern ymCurrentSample_t  YMCurrentSample;
-
-extern void ymResetCurrentSample();
-
-
 // Create object
 extern	YMMUSIC *		ymMusicCreate();
+extern	YMMUSIC *		ymMusicCreateWithRate(ymint replayRate);		// PCM rendered at replayRate Hz rather than 44100
 
 // Release object
 extern	void			ymMusicDestroy(YMMUSIC *pMusic);
+extern	void			ymMusicUnload(YMMUSIC *pMusic);		// Song released, its buffers kept to load the next one into the same object
+extern	void			ymMusicTrim(YMMUSIC *pMusic);			// Same, and those buffers (and the YM-Tracker tables) freed
 
 // Global settings
 extern	void			ymMusicSetLowpassFiler(YMMUSIC *pMus,ymbool bActive);
 
 // Functions
-extern	ymbool			ymMusicLoad(YMMUSIC *pMusic,const char *fName);						// Method 1 : Load file using stdio library (fopen/fread, etc..)
+extern	ymbool			ymMusicLoad(YMMUSIC *pMusic,const char *fName);						// Method 1 : Load file (mapped where possible, else using stdio fopen/fread, etc..)
 extern	ymbool			ymMusicLoadMemory(YMMUSIC *pMusic,void *pBlock,ymu32 size);			// Method 2 : Load file from a memory block
+extern	ymbool			ymMusicLoadMemoryNoCopy(YMMUSIC *pMusic,void *pBlock,ymu32 size);	// Method 3 : Same without a copy, pBlock must stay valid until the music is unloaded or destroyed
 
 extern	ymbool			ymMusicCompute(YMMUSIC *pMusic,ymsample *pBuffer,ymint nbSample);	// Render nbSample samples of current YM tune into pBuffer PCM 16bits mono sample buffer.
+extern	ymbool			ymMusicStepFrame(YMMUSIC *pMusic,ymCurrentSample_t *pWrites);		// Play one frame (VBL) without any PCM rendering, pWrites gets that frame register writes.
+extern	ymbool			ymMusicStepFrameEvents(YMMUSIC *pMusic,ymCurrentSample_t *pWrites,ymEffectEvent_t *pEvents,ymint maxEvents,ymint *pNbEvents);	// Same, plus the writes the effects then make during the frame, up to maxEvents of them.
+extern	ymbool			ymMusicWaveCreate(YMMUSIC *pMusic,char *fName);			// Render the rest of the song (no loop) to a mono 16 bits WAV file.
+extern	ymbool			ymMusicStepFrameDirect(YMMUSIC *pMusic,ymu8 *pRegisters,ymu16 *pWritten);	// Same writes read straight from the YM stream: pRegisters[16] values, bit N of pWritten set if register N is written. Doesn't run the player nor the chip.
 
+extern	void			ymMusicSetStats(YMMUSIC *pMusic,ymStats_t *pStats);		// Phase timings added to *pStats, NULL (default) to stop
 extern	void			ymMusicSetLoopMode(YMMUSIC *pMusic,ymbool bLoop);
 extern	const char	*	ymMusicGetLastError(YMMUSIC *pMusic);
 extern	int				ymMusicGetRegister(YMMUSIC *pMusic,ymint reg);
@@ -91,6 +107,12 @@ extern	ymbool			ymMusicIsOver(YMMUSIC *_pMus);
 
 extern	void			ymMusicRestart(YMMUSIC *pMusic);
 
+// Register writes capture, each music instance has its own
+extern	const ymCurrentSample_t *ymMusicGetCurrentSample(YMMUSIC *pMusic);		// Registers written since last reset
+extern	void			ymMusicResetCurrentSample(YMMUSIC *pMusic);
+extern	void			ymMusicSetRegisterObserver(YMMUSIC *pMusic,ymRegisterObserver_t pObserver,void *pUser);	// pObserver called on every write, NULL to stop
+extern	void			ymMusicSetFrameObserver(YMMUSIC *pMusic,ymFrameObserver_t pObserver,void *pUser);	// Or once per frame with all its writes, replaces the register observer while set
+
 extern	ymbool			ymMusicIsSeekable(YMMUSIC *pMusic);
 extern	ymu32			ymMusicGetPos(YMMUSIC *pMusic);
 extern	void			ymMusicSeek(YMMUSIC *pMusic,ymu32 timeInMs);
@@ -0,0 +1,131 @@
+/*
+ * convertym
+ * Copyright (C) 2024 Pat Deegan, https://psychogenic.com
+ *
+ * convertym --stream device output and pacing, see Stream.h
+ */
+
+#include "Stream.h"
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+
+namespace {
+
+uint64_t nowNs()
+{
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void sleepUntil(uint64_t ns)
+{
+        std::this_thread::sleep_until(std::chrono::steady_clock::time_point(std::chrono::nanoseconds(ns)));
+}
+
+} // namespace
+
+
+int openStreamDevice(const std::string & path, std::string & error)
+{
+        if (path == "-") {
+                return STDOUT_FILENO;
+        }
+        int fd = open(path.c_str(), O_WRONLY | O_NOCTTY);
+        if (fd < 0) {
+                error = "Can't open " + path + ": " + strerror(errno);
+                return -1;
+        }
+        // the bytes as they are, no line discipline in the way
+        struct termios tio;
+        if (isatty(fd) && tcgetattr(fd, &tio) == 0) {
+                cfmakeraw(&tio);
+                if (tcsetattr(fd, TCSANOW, &tio) != 0) {
+                        error = "Can't make " + path + " raw: " + strerror(errno);
+                        close(fd);
+                        return -1;
+                }
+        }
+        return fd;
+}
+
+/*
+ * The first STREAM_LEAD_FRAMES frames go out as soon as they are there,
+ * waiting on those is the capture starting, not an underrun.  The next
+ * is due a periodNs after the lead is out, then each a periodNs of the
+ * one before: the device plays the lead out of its own buffer while the
+ * next one is on its way.  A frame that isn't captured yet when due is
+ * an underrun, it goes out when it is and the ones after are due from
+ * then on.  If fd fails, frames are still
+ * taken off the ring, so that the capture can carry on to its end.
+ */
+bool streamFrames(int fd, CStreamRing & ring, uint64_t startedNs, StreamCounters & counters)
+{
+        uint64_t due = 0;               // when the next frame has to go out, once the lead is
+        bool late = false;
+        bool ok = true;
+        for (;;) {
+                StreamFrame * frame = ring.front();
+                if (! frame) {
+                        if (ok && ! late && counters.frames >= STREAM_LEAD_FRAMES && nowNs() > due) {
+                                counters.underruns++;
+                                late = true;
+                        }
+                        std::this_thread::sleep_for(std::chrono::microseconds(STREAM_POLL_US));
+                        continue;
+                }
+                if (frame->last) {
+                        ok = ok && writeAll(fd, frame->bytes.data(), frame->bytes.size());
+                        ring.pop();
+                        return ok;
+                }
+                bool lead = counters.frames < STREAM_LEAD_FRAMES;
+                if (ok && ! late && ! lead) {
+                        sleepUntil(due);
+                }
+                uint64_t now = nowNs();
+                if (late) {
+                        due = now;
+                        late = false;
+                } else if (! lead && now > due) {
+                        counters.jitterMaxNs = std::max(counters.jitterMaxNs, now - due);
+                        counters.jitterSumNs += now - due;
+                }
+                ok = ok && writeAll(fd, frame->bytes.data(), frame->bytes.size());
+                uint64_t written = nowNs();
+                if (! counters.frames) {
+                        counters.startNs = written - startedNs;
+                }
+                counters.latencyMaxNs = std::max(counters.latencyMaxNs, written - frame->capturedNs);
+                counters.frames++;
+                if (counters.frames == STREAM_LEAD_FRAMES) {
+                        due = written;
+                }
+                if (counters.frames >= STREAM_LEAD_FRAMES) {
+                        due += frame->periodNs;
+                }
+                ring.pop();
+        }
+}
+
+bool writeAll(int fd, const void * data, std::size_t size)
+{
+        const uint8_t * p = (const uint8_t *)data;
+        std::size_t done = 0;
+        while (done < size) {
+                ssize_t n = write(fd, p + done, size - done);
+                if (n < 0 && errno == EINTR) {
+                        continue;
+                }
+                if (n <= 0) {
+                        return false;
+                }
+                done += n;
+        }
+        return true;
+}
@@ -0,0 +1,88 @@
+/*
+ * convertym
+ * Copyright (C) 2024 Pat Deegan, https://psychogenic.com
+ *
+ * convertym --stream: a song played out to a device (a serial port, or
+ * the RP2040's USB one) while it is converted.  The capture thread hands
+ * the output of each frame over to the thread that paces them out,
+ * through a ring of frames with no lock: one thread only ever pushes,
+ * the other only ever pops.  The device is sent STREAM_LEAD_FRAMES ahead
+ * of what it plays and no more, so it never waits long for a frame nor
+ * plays one long after it was captured.
+ */
+
+#ifndef __STREAM__
+#define __STREAM__
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+// frames the capture can be ahead of the device, a power of 2
+#define STREAM_RING_FRAMES      64
+// frames sent ahead of when they play, for the device's own jitter
+#define STREAM_LEAD_FRAMES      4
+// how often an empty ring is looked at again
+#define STREAM_POLL_US          200
+
+typedef struct {
+    std::vector<uint8_t> bytes;         // the output of the frame, the header comes with the first
+    uint64_t periodNs;                  // how long the device plays it for
+    uint64_t capturedNs;
+    bool last;                          // not a frame, the end of the output (a trailer, if any)
+} StreamFrame;
+
+// one thread push()es, another pop()s
+class CStreamRing
+{
+public:
+        CStreamRing() : m_head(0), m_tail(0) {}
+
+        // the frame to fill in then push(), NULL while the ring is full
+        StreamFrame * back() {
+                uint32_t tail = m_tail.load(std::memory_order_relaxed);
+                if (tail - m_head.load(std::memory_order_acquire) == STREAM_RING_FRAMES) {
+                        return NULL;
+                }
+                return &m_frames[tail % STREAM_RING_FRAMES];
+        }
+        void push() { m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+        // the oldest frame pushed, NULL while there is none
+        StreamFrame * front() {
+                uint32_t head = m_head.load(std::memory_order_relaxed);
+                if (head == m_tail.load(std::memory_order_acquire)) {
+                        return NULL;
+                }
+                return &m_frames[head % STREAM_RING_FRAMES];
+        }
+        void pop() { m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+private:
+        StreamFrame m_frames[STREAM_RING_FRAMES];      // their bytes are kept from one lap to the next
+        alignas(64) std::atomic<uint32_t> m_head;     // next to pop
+        alignas(64) std::atomic<uint32_t> m_tail;     // next to push
+};
+
+// how it went, the times in nanoseconds
+typedef struct {
+    uint64_t frames;
+    uint64_t startNs;                   // from starting the conversion to the first frame written
+    uint64_t underruns;                 // frames that weren't captured yet when due
+    uint64_t jitterMaxNs;               // how late frames went out against when they were due
+    uint64_t jitterSumNs;
+    uint64_t latencyMaxNs;              // from a frame captured to it written
+} StreamCounters;
+
+// path opened to write to, made raw if it's a terminal; -1 with why in error
+int openStreamDevice(const std::string & path, std::string & error);
+
+// frames off ring written to fd in time, up to the last one; false if fd fails.
+// The conversion started at startedNs, on the steady clock.
+bool streamFrames(int fd, CStreamRing & ring, uint64_t startedNs, StreamCounters & counters);
+
+// all of data to fd, through short writes and signals
+bool writeAll(int fd, const void * data, std::size_t size);
+
+#endif
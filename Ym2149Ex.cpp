@@ -41,10 +41,12 @@
 #include <math.h>
 #include <stdio.h>
 #include "Ym2149Ex.h"
-#include <iostream>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define YM_SSE2
+#include <emmintrin.h>
+#endif
 
-extern ymCurrentSample_t  YMCurrentSample;
 
 //-------------------------------------------------------------------
 // env shapes.
@@ -152,6 +154,22 @@ ymint i,env;
 		pVolB = &volB;
 		pVolC = &volC;
 
+	// No one is watching register writes yet.
+		m_pObserver = NULL;
+		m_pObserverUser = NULL;
+		m_pFrameObserver = NULL;
+		m_pFrameObserverUser = NULL;
+		m_frame = 0;
+		resetCurrentSample();
+
+	// No effect running, for the renderer choice.
+		memset(specialEffect,0,sizeof(specialEffect));
+		bSyncBuzzer = YMFALSE;
+		m_pEvents = NULL;
+		m_nbEvent = 0;
+		m_maxEvents = 0;
+		m_effectSample = 0;
+
 	// Reset YM2149
 		reset();
 
@@ -167,6 +185,25 @@ void	CYm2149Ex::setClock(ymu32 _clock)
 		internalClock = _clock;
 }
 
+void	CYm2149Ex::setRegisterObserver(ymRegisterObserver_t pObserver,void *pUser)
+{
+		m_pObserver = pObserver;
+		m_pObserverUser = pUser;
+}
+
+void	CYm2149Ex::setFrameObserver(ymFrameObserver_t pObserver,void *pUser)
+{
+		m_pFrameObserver = pObserver;
+		m_pFrameObserverUser = pUser;
+}
+
+void	CYm2149Ex::resetCurrentSample(void)
+{
+		for (ymint i=0;i<YMNUMREGISTERS;i++)
+			m_currentSample.registers[i] = -1;
+		m_currentSample.ready = YMFALSE;
+}
+
 
 ymu32 CYm2149Ex::toneStepCompute(ymu8 rHigh,ymu8 rLow)
 {
@@ -251,6 +288,9 @@ void	CYm2149Ex::reset(void)
 		writeRegister(i,0);
 
 	writeRegister(7,0xff);
+	memset(m_effectRegs,0,sizeof(m_effectRegs));
+	m_effectRegs[7] = 0xff;
+	m_effectDirty = 0;
 
 	currentNoise = 0xffff;
 	rndRack = 1;
@@ -274,19 +314,20 @@ void	CYm2149Ex::reset(void)
 }
 
 
-void	CYm2149Ex::sidVolumeCompute(ymint voice,ymint *pVol)
+template <ymbool bSid,ymbool bDrum>
+inline void	CYm2149Ex::sidVolumeCompute(ymint voice,ymint *pVol)
 {
 
 		struct	YmSpecialEffect	*pVoice = specialEffect+voice;
 
-		if (pVoice->bSid)
+		if ((bSid) && (pVoice->bSid))
 		{
 			if (pVoice->sidPos & (1<<31))
 				writeRegister(8+voice,pVoice->sidVol);
 			else
 				writeRegister(8+voice,0);
 		}
-		else if (pVoice->bDrum)
+		else if ((bDrum) && (pVoice->bDrum))
 		{
 //			writeRegister(8+voice,pVoice->drumData[pVoice->drumPos>>DRUM_PREC]>>4);
 
@@ -328,82 +369,316 @@ int CYm2149Ex::LowPassFilter(int in)
 	return out;
 }
 
-ymsample CYm2149Ex::nextSample(void)
+//-------------------------------------------------------------------
+// Raw samples, before the DC adjust and filter, with the effects that
+// may be running: one variant per set of effects, see selectRenderer().
+//-------------------------------------------------------------------
+template <ymbool bSid,ymbool bDrum,ymbool bBuzzer>
+void	CYm2149Ex::renderEffects(ymint *pRaw,ymint nbSample)
 {
 ymint vol;
 ymint bt,bn;
 
-		if (noisePos&0xffff0000)
+		for (ymint i=0;i<nbSample;i++)
+		{
+			if (noisePos&0xffff0000)
+			{
+				currentNoise ^= rndCompute();
+				noisePos &= 0xffff;
+			}
+			bn = currentNoise;
+
+			volE = ymVolumeTable[envData[envShape][envPhase][envPos>>(32-5)]];
+
+			sidVolumeCompute<bSid,bDrum>(0,&volA);
+			sidVolumeCompute<bSid,bDrum>(1,&volB);
+			sidVolumeCompute<bSid,bDrum>(2,&volC);
+
+		//---------------------------------------------------
+		// Tone+noise+env+DAC for three voices !
+		//---------------------------------------------------
+			bt = ((((yms32)posA)>>31) | mixerTA) & (bn | mixerNA);
+			vol  = (*pVolA)&bt;
+			bt = ((((yms32)posB)>>31) | mixerTB) & (bn | mixerNB);
+			vol += (*pVolB)&bt;
+			bt = ((((yms32)posC)>>31) | mixerTC) & (bn | mixerNC);
+			vol += (*pVolC)&bt;
+
+		//---------------------------------------------------
+		// Inc
+		//---------------------------------------------------
+			posA += stepA;
+			posB += stepB;
+			posC += stepC;
+			noisePos += noiseStep;
+			envPos += envStep;
+			if (0 == envPhase)
+			{
+				if (envPos<envStep)
+				{
+					envPhase = 1;
+				}
+			}
+
+			if (bBuzzer)
+			{
+				syncBuzzerPhase += syncBuzzerStep;
+				if (syncBuzzerPhase&(1<<31))
+				{
+					envPos = 0;
+					envPhase = 0;
+					syncBuzzerPhase &= 0x7fffffff;
+				}
+			}
+
+			if (bSid)
+			{
+				specialEffect[0].sidPos += specialEffect[0].sidStep;
+				specialEffect[1].sidPos += specialEffect[1].sidStep;
+				specialEffect[2].sidPos += specialEffect[2].sidStep;
+			}
+
+			pRaw[i] = vol;
+		}
+
+		if (!bSid)
+		{
+			specialEffect[0].sidPos += nbSample*specialEffect[0].sidStep;
+			specialEffect[1].sidPos += nbSample*specialEffect[1].sidStep;
+			specialEffect[2].sidPos += nbSample*specialEffect[2].sidStep;
+		}
+		if (bDrum)
+			selectRenderer();			// a drum may be over
+}
+
+//-------------------------------------------------------------------
+// Raw sample renderers, by active effects: bit 0 SID, 1 drum, 2 buzzer.
+//-------------------------------------------------------------------
+const CYm2149Ex::renderer_t	CYm2149Ex::s_renderers[8] =
+{
+		&CYm2149Ex::renderBlock,
+		&CYm2149Ex::renderEffects<YMTRUE,YMFALSE,YMFALSE>,
+		&CYm2149Ex::renderEffects<YMFALSE,YMTRUE,YMFALSE>,
+		&CYm2149Ex::renderEffects<YMTRUE,YMTRUE,YMFALSE>,
+		&CYm2149Ex::renderEffects<YMFALSE,YMFALSE,YMTRUE>,
+		&CYm2149Ex::renderEffects<YMTRUE,YMFALSE,YMTRUE>,
+		&CYm2149Ex::renderEffects<YMFALSE,YMTRUE,YMTRUE>,
+		&CYm2149Ex::renderEffects<YMTRUE,YMTRUE,YMTRUE>,
+};
+
+//-------------------------------------------------------------------
+// Pick the renderers for the effects running now and the filter,
+// every time one of them starts or stops.
+//-------------------------------------------------------------------
+void	CYm2149Ex::selectRenderer(void)
+{
+ymint	effects = 0;
+
+		for (ymint voice=0;voice<3;voice++)
 		{
-			currentNoise ^= rndCompute();
-			noisePos &= 0xffff;
+			if (specialEffect[voice].bSid) effects |= 1;
+			if (specialEffect[voice].bDrum) effects |= 2;
 		}
-		bn = currentNoise;
-
-		volE = ymVolumeTable[envData[envShape][envPhase][envPos>>(32-5)]];
-
-		sidVolumeCompute(0,&volA);
-		sidVolumeCompute(1,&volB);
-		sidVolumeCompute(2,&volC);
-
-	//---------------------------------------------------
-	// Tone+noise+env+DAC for three voices !
-	//---------------------------------------------------
-		bt = ((((yms32)posA)>>31) | mixerTA) & (bn | mixerNA);
-		vol  = (*pVolA)&bt;
-		bt = ((((yms32)posB)>>31) | mixerTB) & (bn | mixerNB);
-		vol += (*pVolB)&bt;
-		bt = ((((yms32)posC)>>31) | mixerTC) & (bn | mixerNC);
-		vol += (*pVolC)&bt;
-
-	//---------------------------------------------------
-	// Inc
-	//---------------------------------------------------
-		posA += stepA;
-		posB += stepB;
-		posC += stepC;
-		noisePos += noiseStep;
-		envPos += envStep;
-		if (0 == envPhase)
+		if (bSyncBuzzer) effects |= 4;
+
+		m_pRender = s_renderers[effects];
+		m_pDcAdjust = (m_bFilter) ? &CYm2149Ex::dcAdjust<YMTRUE> : &CYm2149Ex::dcAdjust<YMFALSE>;
+}
+
+void	CYm2149Ex::setFilter(ymbool bFilter)
+{
+		m_bFilter = bFilter;
+		selectRenderer();
+}
+
+//-------------------------------------------------------------------
+// Same raw samples as renderEffects(), for a block where no SID, drum or
+// sync buzzer runs.  Noise and envelope carry from one sample to the
+// next, so they go first, then the voices are mixed 4 samples at a time.
+//-------------------------------------------------------------------
+void	CYm2149Ex::renderBlock(ymint *pRaw,ymint nbSample)
+{
+ymu32	noise[YM_RENDER_BLOCK];
+ymint	env[YM_RENDER_BLOCK];
+ymint	i;
+
+		for (i=0;i<nbSample;i++)
 		{
-			if (envPos<envStep)
+			if (noisePos&0xffff0000)
 			{
+				currentNoise ^= rndCompute();
+				noisePos &= 0xffff;
+			}
+			noise[i] = currentNoise;
+			noisePos += noiseStep;
+
+			env[i] = ymVolumeTable[envData[envShape][envPhase][envPos>>(32-5)]];
+			envPos += envStep;
+			if ((0 == envPhase) && (envPos<envStep))
 				envPhase = 1;
+		}
+		volE = env[nbSample-1];
+
+		ymu32	*pPos[3] = { &posA,&posB,&posC };
+		const ymu32	step[3] = { stepA,stepB,stepC };
+		const ymu32	mixerT[3] = { mixerTA,mixerTB,mixerTC };
+		const ymu32	mixerN[3] = { mixerNA,mixerNB,mixerNC };
+		const ymint	vol[3] = { volA,volB,volC };
+		const ymbool bEnv[3] = { pVolA==&volE, pVolB==&volE, pVolC==&volE };
+
+		i = 0;
+#ifdef YM_SSE2
+		__m128i pos4[3],step4[3],mixerT4[3],mixerN4[3],vol4[3],env4[3];
+		for (ymint v=0;v<3;v++)
+		{
+			const ymu32 p = *pPos[v];
+			const ymu32 s = step[v];
+			pos4[v] = _mm_set_epi32(p+3*s,p+2*s,p+s,p);
+			step4[v] = _mm_set1_epi32(4*s);
+			mixerT4[v] = _mm_set1_epi32(mixerT[v]);
+			mixerN4[v] = _mm_set1_epi32(mixerN[v]);
+			vol4[v] = _mm_set1_epi32(vol[v]);
+			env4[v] = _mm_set1_epi32(bEnv[v] ? -1 : 0);
+		}
+		for (;i+4<=nbSample;i+=4)
+		{
+			const __m128i bn = _mm_loadu_si128((const __m128i*)(noise+i));
+			const __m128i ve = _mm_loadu_si128((const __m128i*)(env+i));
+			__m128i out = _mm_setzero_si128();
+			for (ymint v=0;v<3;v++)
+			{
+				const __m128i bt = _mm_and_si128(_mm_or_si128(_mm_srai_epi32(pos4[v],31),mixerT4[v]),
+												 _mm_or_si128(bn,mixerN4[v]));
+				const __m128i src = _mm_or_si128(_mm_and_si128(env4[v],ve),_mm_andnot_si128(env4[v],vol4[v]));
+				out = _mm_add_epi32(out,_mm_and_si128(src,bt));
+				pos4[v] = _mm_add_epi32(pos4[v],step4[v]);
 			}
+			_mm_storeu_si128((__m128i*)(pRaw+i),out);
 		}
-
-		syncBuzzerPhase += syncBuzzerStep;
-		if (syncBuzzerPhase&(1<<31))
+#endif
+		for (ymint v=0;v<3;v++)
+			*pPos[v] += i*step[v];
+		for (;i<nbSample;i++)
 		{
-			envPos = 0;
-			envPhase = 0;
-			syncBuzzerPhase &= 0x7fffffff;
+			ymint out = 0;
+			for (ymint v=0;v<3;v++)
+			{
+				const ymint bt = ((((yms32)*pPos[v])>>31) | mixerT[v]) & (noise[i] | mixerN[v]);
+				out += (bEnv[v] ? env[i] : vol[v]) & bt;
+				*pPos[v] += step[v];
+			}
+			pRaw[i] = out;
 		}
 
-		specialEffect[0].sidPos += specialEffect[0].sidStep;
-		specialEffect[1].sidPos += specialEffect[1].sidStep;
-		specialEffect[2].sidPos += specialEffect[2].sidStep;
+		specialEffect[0].sidPos += nbSample*specialEffect[0].sidStep;
+		specialEffect[1].sidPos += nbSample*specialEffect[1].sidStep;
+		specialEffect[2].sidPos += nbSample*specialEffect[2].sidStep;
+}
 
-	//---------------------------------------------------
-	// Normalize process
-	//---------------------------------------------------
-		m_dcAdjust.AddSample(vol);
-		const int in = vol - m_dcAdjust.GetDcLevel();
-		return (m_bFilter) ? LowPassFilter(in) : in;
+//-------------------------------------------------------------------
+// Normalize process, second pass over the raw samples.
+//-------------------------------------------------------------------
+template <ymbool bFilter>
+void	CYm2149Ex::dcAdjust(const ymint *pRaw,ymsample *pOut,ymint nbSample)
+{
+		for (ymint i=0;i<nbSample;i++)
+		{
+			m_dcAdjust.AddSample(pRaw[i]);
+			const int in = pRaw[i] - m_dcAdjust.GetDcLevel();
+			pOut[i] = (bFilter) ? LowPassFilter(in) : in;
+		}
 }
 
 
 ymint		CYm2149Ex::readRegister(ymint reg)
 {
-		std::cout << "rr:" << reg << std::endl;
+		YM_TRACE_PRINTF("rr:%d\n",(int)reg);
 		if ((reg>=0) && (reg<=13)) return registers[reg];
 		else return -1;
 }
 
 void	CYm2149Ex::writeRegister(ymint reg,ymint data)
 {
-		//std::cout << "wr:" << reg << "," << data << std::endl;
-		
+		YM_TRACE_PRINTF("wr:%d,%d\n",(int)reg,(int)data);
+		setRegister(reg,data);
+		logWrite(reg,data);
+		if (m_pFrameObserver)
+		{
+			ymu8 value[YMNUMREGISTERS];
+			value[reg] = data & 0xff;
+			m_pFrameObserver(m_pFrameObserverUser,m_frame,value,1<<reg);
+		}
+}
+
+void	CYm2149Ex::logWrite(ymint reg,ymint data)
+{
+		m_currentSample.ready = YMTRUE;
+		m_currentSample.registers[reg] = data & 0xff;
+		if ((m_pObserver) && (!m_pFrameObserver))
+			m_pObserver(m_pObserverUser,m_frame,reg,data & 0xff);
+}
+
+//-------------------------------------------------------------------
+// Same chip state as writeRegister() for each register of mask in turn,
+// but tone, noise and envelope steps are only computed once per frame,
+// and only if their registers do change.  Mixer, volumes and envelope
+// shape are always set again: the drums override the first two while
+// rendering, and writing 13 restarts the envelope.
+//-------------------------------------------------------------------
+void	CYm2149Ex::writeRegisters(const ymu8 *pRegs,ymu16 mask)
+{
+		ymu32	*pStep[3] = { &stepA,&stepB,&stepC };
+		ymu32	*pPos[3] = { &posA,&posB,&posC };
+
+		for (ymint voice=0;voice<3;voice++)
+		{
+			const ymint rLow = voice*2;
+			const ymint rHigh = rLow+1;
+			const ymu8 low = (mask&(1<<rLow)) ? pRegs[rLow] : registers[rLow];
+			const ymu8 high = (mask&(1<<rHigh)) ? (pRegs[rHigh]&15) : registers[rHigh];
+			if ((low == registers[rLow]) && (high == registers[rHigh]))
+				continue;
+			// the low byte goes first, with the old high byte
+			if ((mask&(1<<rLow)) && ((registers[rHigh]<<8)+low <= 5))
+				*pPos[voice] = (1<<31);
+			registers[rLow] = low;
+			registers[rHigh] = high;
+			*pStep[voice] = toneStepCompute(high,low);
+			if (!*pStep[voice]) *pPos[voice] = (1<<31);		// Assume output always 1 if 0 period (for Digi-sample !)
+		}
+
+		if ((mask&(1<<6)) && ((pRegs[6]&0x1f) != registers[6]))
+			setRegister(6,pRegs[6]);
+
+		for (ymint reg=7;reg<=10;reg++)
+		{
+			if (mask&(1<<reg))
+				setRegister(reg,pRegs[reg]);
+		}
+
+		const ymu8 envLow = (mask&(1<<11)) ? pRegs[11] : registers[11];
+		const ymu8 envHigh = (mask&(1<<12)) ? pRegs[12] : registers[12];
+		if ((envLow != registers[11]) || (envHigh != registers[12]))
+		{
+			registers[11] = envLow;
+			registers[12] = envHigh;
+			envStep = envStepCompute(envHigh,envLow);
+		}
+
+		if (mask&(1<<13))
+			setRegister(13,pRegs[13]);
+
+		for (ymint reg=0;reg<YMNUMREGISTERS;reg++)
+		{
+			if (mask&(1<<reg))
+				logWrite(reg,pRegs[reg]);
+		}
+		if ((m_pFrameObserver) && (mask))
+			m_pFrameObserver(m_pFrameObserverUser,m_frame,pRegs,mask);
+}
+
+void	CYm2149Ex::setRegister(ymint reg,ymint data)
+{
 		switch (reg)
 		{
 		case 0:
@@ -507,24 +782,98 @@ void	CYm2149Ex::writeRegister(ymint reg,ymint data)
 			break;
 
 		}
-		
-		YMCurrentSample.ready = YMTRUE;
-		YMCurrentSample.registers[reg] = data & 0xff;
 }
 
 void	CYm2149Ex::update(ymsample *pSampleBuffer,ymint nbSample)
 {
+ymint	raw[YM_RENDER_BLOCK];
+
+		while (nbSample>0)
+		{
+			const ymint n = (nbSample<YM_RENDER_BLOCK) ? nbSample : YM_RENDER_BLOCK;
+			(this->*m_pRender)(raw,n);
+			(this->*m_pDcAdjust)(raw,pSampleBuffer,n);
+			pSampleBuffer += n;
+			nbSample -= n;
+		}
+}
 
-		ymsample *pBuffer = pSampleBuffer;
-		if (nbSample>0)
+//-------------------------------------------------------------------
+// Fast forward: the chip state update() would leave after nbSample,
+// but the DC adjuster and low-pass filter, which only remember the last
+// few hundred samples anyway.  Without any effect running, the phases
+// move by nbSample steps at once and the noise generator by as many
+// random bits as its position overflows.
+//-------------------------------------------------------------------
+void	CYm2149Ex::skip(ymint nbSample)
+{
+		if (m_pRender != &CYm2149Ex::renderBlock)
+		{	// effects have to be played sample by sample
+			ymint raw[YM_RENDER_BLOCK];
+			while (nbSample>0)
+			{
+				const ymint n = (nbSample<YM_RENDER_BLOCK) ? nbSample : YM_RENDER_BLOCK;
+				(this->*m_pRender)(raw,n);
+				nbSample -= n;
+			}
+			return;
+		}
+		if (nbSample<=0)
+			return;
+
+		if ((noiseStep < 0x10000) && (noisePos < 0x20000))
+		{	// wraps once at most per sample, so this many times after the last add
+			const uint64_t end = (uint64_t)noisePos + (uint64_t)nbSample*noiseStep;
+			const uint64_t nbWrap = (end - noiseStep) >> 16;
+			for (uint64_t i=0;i<nbWrap;i++)
+				currentNoise ^= rndCompute();
+			noisePos = (ymu32)(end - (nbWrap<<16));
+		}
+		else
 		{
-			do
+			for (ymint i=0;i<nbSample;i++)
 			{
-				*pBuffer++ = nextSample();
+				if (noisePos&0xffff0000)
+				{
+					currentNoise ^= rndCompute();
+					noisePos &= 0xffff;
+				}
+				noisePos += noiseStep;
 			}
-			while (--nbSample);
 		}
 
+		// the first phase is over as soon as the position wraps
+		const uint64_t envEnd = (uint64_t)envPos + (uint64_t)nbSample*envStep;
+		if ((0 == envPhase) && (envEnd >> 32))
+			envPhase = 1;
+		envPos = (ymu32)envEnd;
+
+		posA += nbSample*stepA;
+		posB += nbSample*stepB;
+		posC += nbSample*stepC;
+		specialEffect[0].sidPos += nbSample*specialEffect[0].sidStep;
+		specialEffect[1].sidPos += nbSample*specialEffect[1].sidStep;
+		specialEffect[2].sidPos += nbSample*specialEffect[2].sidStep;
+}
+
+void	CYm2149Ex::copyState(const CYm2149Ex &from)
+{
+		ymRegisterObserver_t	pObserver = m_pObserver;
+		void				*	pObserverUser = m_pObserverUser;
+		ymFrameObserver_t		pFrameObserver = m_pFrameObserver;
+		void				*	pFrameObserverUser = m_pFrameObserverUser;
+
+		*this = from;
+
+		m_pObserver = pObserver;
+		m_pObserverUser = pObserverUser;
+		m_pFrameObserver = pFrameObserver;
+		m_pFrameObserverUser = pFrameObserverUser;
+
+		// volumes point inside the chip
+		pVolA = (from.pVolA == &from.volE) ? &volE : &volA;
+		pVolB = (from.pVolB == &from.volE) ? &volE : &volB;
+		pVolC = (from.pVolC == &from.volE) ? &volE : &volC;
 }
 
 void	CYm2149Ex::drumStart(ymint voice,ymu8 *pDrumBuffer,ymu32 drumSize,ymint drumFreq)
@@ -536,12 +885,14 @@ void	CYm2149Ex::drumStart(ymint voice,ymu8 *pDrumBuffer,ymu32 drumSize,ymint dru
 		specialEffect[voice].drumSize = drumSize;
 		specialEffect[voice].drumStep = (drumFreq<<DRUM_PREC)/replayFrequency;
 		specialEffect[voice].bDrum = YMTRUE;
+		selectRenderer();
 	}
 }
 
 void	CYm2149Ex::drumStop(ymint voice)
 {
 		specialEffect[voice].bDrum = YMFALSE;
+		selectRenderer();
 }
 
 void	CYm2149Ex::sidStart(ymint voice,ymint timerFreq,ymint vol)
@@ -554,6 +905,7 @@ void	CYm2149Ex::sidStart(ymint voice,ymint timerFreq,ymint vol)
 		specialEffect[voice].sidStep = (ymu32)tmp;
 		specialEffect[voice].sidVol = vol&15;
 		specialEffect[voice].bSid = YMTRUE;
+		selectRenderer();
 }
 
 void	CYm2149Ex::sidSinStart(ymint voice,ymint timerFreq,ymint vol)
@@ -564,6 +916,7 @@ void	CYm2149Ex::sidSinStart(ymint voice,ymint timerFreq,ymint vol)
 void	CYm2149Ex::sidStop(ymint voice)
 {
 		specialEffect[voice].bSid = YMFALSE;
+		selectRenderer();
 }
 
 void	CYm2149Ex::syncBuzzerStart(ymint timerFreq,ymint _envShape)
@@ -577,6 +930,7 @@ void	CYm2149Ex::syncBuzzerStart(ymint timerFreq,ymint _envShape)
 		syncBuzzerStep = (ymu32)tmp;
 		syncBuzzerPhase = 0;
 		bSyncBuzzer = YMTRUE;
+		selectRenderer();
 }
 
 void	CYm2149Ex::syncBuzzerStop(void)
@@ -584,5 +938,173 @@ void	CYm2149Ex::syncBuzzerStop(void)
 		bSyncBuzzer = YMFALSE;
 		syncBuzzerPhase = 0;
 		syncBuzzerStep = 0;
+		selectRenderer();
+}
+
+//-------------------------------------------------------------------
+// The 4 bits volume closest to what renderEffects() outputs for a drum sample
+//-------------------------------------------------------------------
+ymu8	CYm2149Ex::drumVolume(ymu8 sample) const
+{
+		const ymint level = (sample * 255) / 6;
+		ymu8 best = 0;
+		for (ymint v=1;v<16;v++)
+		{
+			if (abs(ymVolumeTable[v] - level) < abs(ymVolumeTable[best] - level))
+				best = v;
+		}
+		return best;
+}
+
+void	CYm2149Ex::effectWrite(ymint reg,ymint value,ymbool bAlways)
+{
+		if ((!bAlways) && (m_effectRegs[reg] == value))
+			return;
+		m_effectRegs[reg] = value;
+		if (m_nbEvent < m_maxEvents)
+		{
+			m_pEvents[m_nbEvent].sample = m_effectSample;
+			m_pEvents[m_nbEvent].reg = reg;
+			m_pEvents[m_nbEvent].value = value;
+			m_nbEvent++;
+		}
+}
+
+//-------------------------------------------------------------------
+// What renderEffects() does to the chip, sample by sample, as writes a
+// real one can be sent: the SID square on the volume, drum samples as
+// volumes with the voice's tone and noise off in the mixer, and the
+// sync buzzer rewriting the envelope shape (which restarts it).  Only
+// changes are logged, but for the buzzer, and a voice an effect is
+// over on gets its volume back.  The writes logged since the last
+// resetCurrentSample(), the frame's, are what the chip has to start with.
+// Neither tone, noise nor envelope are run.
+//-------------------------------------------------------------------
+ymint	CYm2149Ex::effectEvents(ymint nbSample,ymEffectEvent_t *pEvents,ymint maxEvents)
+{
+ymbool	bDrumOver = YMFALSE;
+
+		for (ymint reg=0;reg<14;reg++)
+		{
+			if (m_currentSample.registers[reg] >= 0)
+			{
+				m_effectRegs[reg] = m_currentSample.registers[reg];
+				m_effectDirty &= ~(1<<reg);
+			}
+		}
+		m_pEvents = pEvents;
+		m_nbEvent = 0;
+		m_maxEvents = maxEvents;
+
+		if ((m_pRender == &CYm2149Ex::renderBlock) && (!m_effectDirty) && (m_effectRegs[7] == registers[7]))
+		{	// nothing running, nor to put back
+			specialEffect[0].sidPos += nbSample*specialEffect[0].sidStep;
+			specialEffect[1].sidPos += nbSample*specialEffect[1].sidStep;
+			specialEffect[2].sidPos += nbSample*specialEffect[2].sidStep;
+			m_pEvents = NULL;
+			return 0;
+		}
+
+		for (m_effectSample=0;m_effectSample<nbSample;m_effectSample++)
+		{
+			ymint mixer = registers[7];
+			for (ymint voice=0;voice<3;voice++)
+			{
+				struct	YmSpecialEffect	*pVoice = specialEffect+voice;
+				const ymint reg = 8+voice;
+				if (pVoice->bSid)
+				{
+					effectWrite(reg,(pVoice->sidPos & (1<<31)) ? pVoice->sidVol : 0,YMFALSE);
+					m_effectDirty |= 1<<reg;
+				}
+				else if (pVoice->bDrum)
+				{
+					mixer |= 9<<voice;
+					effectWrite(reg,drumVolume(pVoice->drumData[pVoice->drumPos>>DRUM_PREC]),YMFALSE);
+					m_effectDirty |= 1<<reg;
+					pVoice->drumPos += pVoice->drumStep;
+					if ((pVoice->drumPos>>DRUM_PREC) >= pVoice->drumSize)
+					{
+						pVoice->bDrum = YMFALSE;
+						bDrumOver = YMTRUE;
+					}
+				}
+				else if (m_effectDirty & (1<<reg))
+				{
+					effectWrite(reg,registers[reg],YMFALSE);
+					m_effectDirty &= ~(1<<reg);
+				}
+			}
+			effectWrite(7,mixer,YMFALSE);
+
+			if (bSyncBuzzer)
+			{
+				effectWrite(13,envShape,YMFALSE);
+				syncBuzzerPhase += syncBuzzerStep;
+				if (syncBuzzerPhase&(1<<31))
+				{
+					envPos = 0;
+					envPhase = 0;
+					syncBuzzerPhase &= 0x7fffffff;
+					effectWrite(13,envShape,YMTRUE);
+				}
+			}
+
+			specialEffect[0].sidPos += specialEffect[0].sidStep;
+			specialEffect[1].sidPos += specialEffect[1].sidStep;
+			specialEffect[2].sidPos += specialEffect[2].sidStep;
+		}
+		if (bDrumOver)
+			selectRenderer();
+		m_pEvents = NULL;
+		return m_nbEvent;
+}
+
+//-------------------------------------------------------------------
+// All of effectEvents() that a later frame sees: the volumes, mixer and
+// their dirty bits are set again by every frame, but the SID phases keep
+// running (stopped or not), drums carry on over frames until their last
+// sample and the buzzer's shape write is the one to compare with next.
+//-------------------------------------------------------------------
+void	CYm2149Ex::effectSkip(ymint nbSample)
+{
+ymbool	bDrumOver = YMFALSE;
+
+		for (ymint reg=0;reg<14;reg++)
+		{
+			if (m_currentSample.registers[reg] >= 0)
+			{
+				m_effectRegs[reg] = m_currentSample.registers[reg];
+				m_effectDirty &= ~(1<<reg);
+			}
+		}
+		if (nbSample <= 0)
+			return;
+
+		for (ymint voice=0;voice<3;voice++)
+		{
+			struct	YmSpecialEffect	*pVoice = specialEffect+voice;
+			if ((pVoice->bDrum) && (!pVoice->bSid))
+			{	// one step a sample, over after the one that reaches drumSize
+				const uint64_t end = (uint64_t)pVoice->drumSize<<DRUM_PREC;
+				const uint64_t left = (end > pVoice->drumPos) ? end - pVoice->drumPos : 1;
+				const uint64_t nbStep = pVoice->drumStep ? (left + pVoice->drumStep - 1) / pVoice->drumStep : nbSample+1;
+				if (nbStep <= (uint64_t)nbSample)
+				{
+					pVoice->drumPos += (ymu32)nbStep*pVoice->drumStep;
+					pVoice->bDrum = YMFALSE;
+					bDrumOver = YMTRUE;
+				}
+				else
+					pVoice->drumPos += nbSample*pVoice->drumStep;
+			}
+			if ((pVoice->bSid) || (pVoice->bDrum))
+				m_effectDirty |= 1<<(8+voice);
+			pVoice->sidPos += nbSample*pVoice->sidStep;
+		}
+		if (bSyncBuzzer)
+			m_effectRegs[13] = envShape;
+		if (bDrumOver)
+			selectRenderer();
 }
 
@@ -73,6 +73,7 @@ struct	YmSpecialEffect
 };
 
 static	const	ymint		DC_ADJUST_BUFFERLEN		=	512;
+static	const	ymint		YM_RENDER_BLOCK			=	1024;		// samples rendered per pass
 
 class	CDcAdjuster
 {
@@ -98,9 +99,12 @@ public:
 
 		void	reset(void);
 		void	update(ymsample *pSampleBuffer,ymint nbSample);
+		void	skip(ymint nbSample);		// as update(), without the output nor the DC adjust and filter history
+		void	copyState(const CYm2149Ex &from);	// all of the emulation state, not the observers
 
 		void	setClock(ymu32 _clock);
 		void	writeRegister(ymint reg,ymint value);
+		void	writeRegisters(const ymu8 *pRegisters,ymu16 mask);	// a whole frame, bit N of mask for register N
 		ymint	readRegister(ymint reg);
 		void	drumStart(ymint voice,ymu8 *drumBuffer,ymu32 drumSize,ymint drumFreq);
 		void	drumStop(ymint voice);
@@ -109,25 +113,59 @@ public:
 		void	sidStop(ymint voice);
 		void	syncBuzzerStart(ymint freq,ymint envShape);
 		void	syncBuzzerStop(void);
-
-		void	setFilter(ymbool bFilter)		{ m_bFilter = bFilter; }
+		// Run the effects for nbSample without rendering, returns the writes
+		// they amount to since the last ones logged, up to maxEvents of them.
+		ymint	effectEvents(ymint nbSample,ymEffectEvent_t *pEvents,ymint maxEvents);
+		// Leaves the effects as effectEvents() does, SID phases and drums
+		// moved on nbSample samples, without working out any write.
+		void	effectSkip(ymint nbSample);
+
+		void	setFilter(ymbool bFilter);
+
+		// Register writes log and observer, per chip instance.
+		void	setRegisterObserver(ymRegisterObserver_t pObserver,void *pUser);
+		void	setFrameObserver(ymFrameObserver_t pObserver,void *pUser);	// takes over from the register observer
+		void	setFrame(ymu32 frame)			{ m_frame = frame; }
+		const ymCurrentSample_t	*getCurrentSample(void) const	{ return &m_currentSample; }
+		void	resetCurrentSample(void);
 
 private:
 		ymbool m_writes_done;
+		ymCurrentSample_t		m_currentSample;
+		ymRegisterObserver_t	m_pObserver;
+		void				*	m_pObserverUser;
+		ymFrameObserver_t		m_pFrameObserver;
+		void				*	m_pFrameObserverUser;
+		ymu32					m_frame;
 		CDcAdjuster		m_dcAdjust;
 
 		ymu32	frameCycle;
 		ymu32	cyclePerSample;
-		inline	ymsample nextSample(void);
+		typedef	void	(CYm2149Ex::*renderer_t)(ymint *pRaw,ymint nbSample);
+		typedef	void	(CYm2149Ex::*dcAdjuster_t)(const ymint *pRaw,ymsample *pOut,ymint nbSample);
+		static	const	renderer_t	s_renderers[8];
+		renderer_t		m_pRender;
+		dcAdjuster_t	m_pDcAdjust;
+		void	selectRenderer(void);
+		void	renderBlock(ymint *pRaw,ymint nbSample);
+		template <ymbool bSid,ymbool bDrum,ymbool bBuzzer>
+		void	renderEffects(ymint *pRaw,ymint nbSample);
+		template <ymbool bFilter>
+		void	dcAdjust(const ymint *pRaw,ymsample *pOut,ymint nbSample);
 		ymu32 toneStepCompute(ymu8 rHigh,ymu8 rLow);
 		ymu32 noiseStepCompute(ymu8 rNoise);
 		ymu32 envStepCompute(ymu8 rHigh,ymu8 rLow);
+		void	setRegister(ymint reg,ymint value);
+		void	logWrite(ymint reg,ymint value);
 		void	updateEnvGen(ymint nbSample);
 		void	updateNoiseGen(ymint nbSample);
 		void	updateToneGen(ymint voice,ymint nbSample);
 		ymu32	rndCompute(void);
+		void	effectWrite(ymint reg,ymint value,ymbool bAlways);
+		ymu8	drumVolume(ymu8 sample) const;
 
-		void	sidVolumeCompute(ymint voice,ymint *pVol);
+		template <ymbool bSid,ymbool bDrum>
+		inline	void	sidVolumeCompute(ymint voice,ymint *pVol);
 		inline int		LowPassFilter(int in);
 
 		ymint	replayFrequency;
@@ -161,6 +199,15 @@ private:
 		ymu32	syncBuzzerPhase;
 		ymint	syncBuzzerShape;
 
+		// effectEvents(): what the chip has been written, and those of the
+		// volumes an effect has taken over
+		ymu8	m_effectRegs[14];
+		ymu16	m_effectDirty;
+		ymint	m_effectSample;
+		ymEffectEvent_t	*m_pEvents;
+		ymint	m_nbEvent;
+		ymint	m_maxEvents;
+
 		int		m_lowPassFilter[2];
 		ymbool	m_bFilter;
 };
@@ -34,9 +34,11 @@
 *
 -----------------------------------------------------------------------------*/
 
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <chrono>
 #include "YmMusic.h"
 
 #define	_LINEAR_OVRS				// Activate linear oversampling (best quality) Only used for DigiMix and UniversalTracker YM file type
@@ -51,6 +53,16 @@ CYmMusic::CYmMusic(ymint _replayRate) :
     ymChip(ATARI_CLOCK, 1, _replayRate)
 {
 	pBigMalloc = NULL;
+	bBigMallocBorrowed = YMFALSE;
+	bigMallocMapSize = 0;
+	pStreamMalloc = NULL;
+	bDrumBorrowed = YMFALSE;
+	bDrumCached = YMFALSE;
+	pStreamDepacker = NULL;
+	pStreamFile = NULL;
+	bStreamFileBorrowed = YMFALSE;
+	streamFileMapSize = 0;
+	pStreamWindow = NULL;
 	pSongName = NULL;
 	pSongAuthor = NULL;
 	pSongComment = NULL;
@@ -58,6 +70,7 @@ CYmMusic::CYmMusic(ymint _replayRate) :
 	pSongPlayer = NULL;
 
 	pBigSampleBuffer = NULL;
+	bBigSampleBufferBorrowed = YMFALSE;
 	pMixBlock = NULL;
 
 	replayRate = _replayRate;
@@ -68,6 +81,17 @@ CYmMusic::CYmMusic(ymint _replayRate) :
 	setLoopMode(YMFALSE);
 
 	m_pTimeInfo = NULL;
+	pStats = NULL;
+	pTracker = NULL;
+	pSpareDepacker = NULL;
+}
+
+uint64_t	CYmMusic::statsClock(void) const
+{
+		if (!pStats)
+			return 0;
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
 void	CYmMusic::setTimeControl(ymbool bTime)
@@ -80,8 +104,7 @@ void	CYmMusic::setTimeControl(ymbool bTime)
 
 CYmMusic::~CYmMusic()
 {
-		stop();
-		unLoad();
+		trim();
 }
 
 void	CYmMusic::setLoopMode(ymbool bLoopMode)
@@ -298,6 +321,363 @@ ymint	vblNbSample;
 }
 
 
+//-------------------------------------------------------------
+// WAVE Generator: render the song, from where it is to its end (no
+// loop), to a mono 16 bits WAV file at replayRate.  Big blocks go
+// through update() and straight to the file.
+//-------------------------------------------------------------
+static	void	writeLittleEndian(ymu8 *pDst,ymu32 value,ymint nbBytes)
+{
+		for (ymint i=0;i<nbBytes;i++)
+			pDst[i] = (ymu8)(value>>(8*i));
+}
+
+void	CYmMusic::waveHeader(ymu8 *pHeader,ymu32 nbSample) const
+{
+		const ymu32 dataSize = nbSample * sizeof(ymsample);
+		memcpy(pHeader,"RIFF",4);
+		writeLittleEndian(pHeader+4,36+dataSize,4);
+		memcpy(pHeader+8,"WAVEfmt ",8);
+		writeLittleEndian(pHeader+16,16,4);						// fmt chunk size
+		writeLittleEndian(pHeader+20,1,2);						// PCM
+		writeLittleEndian(pHeader+22,1,2);						// mono
+		writeLittleEndian(pHeader+24,replayRate,4);
+		writeLittleEndian(pHeader+28,replayRate*sizeof(ymsample),4);
+		writeLittleEndian(pHeader+32,sizeof(ymsample),2);
+		writeLittleEndian(pHeader+34,16,2);
+		memcpy(pHeader+36,"data",4);
+		writeLittleEndian(pHeader+40,dataSize,4);
+}
+
+int		CYmMusic::waveCreate(char *fName)
+{
+		if (!bMusicOk)
+		{
+			setLastError("No music loaded");
+			return YMFALSE;
+		}
+
+		// the length is known up front, so the header is too
+		const ymbool bMix = ((songType >= YM_MIX1) && (songType < YM_MIXMAX));
+		yms64 nbSample;
+		if (bMix)
+			nbSample = ((yms64)m_musicLenInMs * replayRate) / 1000;
+		else
+			nbSample = (yms64)(nbFrame - currentFrame) * (replayRate/playerRate);
+		if (nbSample < 0) nbSample = 0;
+		if (nbSample > (0x7fffffff-36)/(yms64)sizeof(ymsample))
+		{
+			setLastError("Song too long for a WAV file");
+			return YMFALSE;
+		}
+
+		FILE *out = fopen(fName,"wb");
+		if (!out)
+		{
+			setLastError("Can't create the WAV file");
+			return YMFALSE;
+		}
+
+		ymu8 header[WAVE_HEADER_SIZE];
+		waveHeader(header,(ymu32)nbSample);
+		uint64_t t0 = statsClock();
+		ymbool bOk = (fwrite(header,1,WAVE_HEADER_SIZE,out) == WAVE_HEADER_SIZE);
+		if (pStats)
+			pStats->writeNs += statsClock() - t0;
+
+		// whole frames per block: update() runs the player at the start of
+		// the last part of a frame it renders, so a frame split over two
+		// calls would have the next frame's registers come early
+		ymint blockSize = WAVE_BLOCK_SAMPLES;
+		if ((!bMix) && (replayRate/playerRate > 0))
+			blockSize -= blockSize % (replayRate/playerRate);
+		ymsample *pBuffer = (ymsample*)malloc(blockSize*sizeof(ymsample));
+		if ((pStats) && (pStats->peakBuffer < blockSize*sizeof(ymsample)))
+			pStats->peakBuffer = blockSize*sizeof(ymsample);
+		const ymu16 one = 1;
+		const ymbool bSwap = (*(const ymu8*)&one == 0);	// WAV is little endian
+		const ymbool bLoopMode = bLoop;
+		bLoop = YMFALSE;
+		play();
+
+		while ((bOk) && (nbSample > 0))
+		{
+			const ymint n = (nbSample < blockSize) ? (ymint)nbSample : blockSize;
+			if (bMix)
+				bufferClear(pBuffer,n);		// stDigitMix leaves what's after the end alone
+			update(pBuffer,n);
+			if (bSwap)
+			{
+				for (ymint i=0;i<n;i++)
+					pBuffer[i] = (ymsample)(((ymu16)pBuffer[i]>>8) | ((ymu16)pBuffer[i]<<8));
+			}
+			t0 = statsClock();
+			bOk = (fwrite(pBuffer,sizeof(ymsample),n,out) == (size_t)n);
+			if (pStats)
+				pStats->writeNs += statsClock() - t0;
+			nbSample -= n;
+		}
+
+		bLoop = bLoopMode;
+		free(pBuffer);
+		if (fclose(out) != 0)
+			bOk = YMFALSE;
+		if (!bOk)
+			setLastError("Can't write the WAV file");
+		return bOk;
+}
+
+ymbool	CYmMusic::fastForward(ymint nbFrames)
+{
+		if ((songType < YM_V2) || (songType >= YM_VMAX))
+		{
+			setLastError("No YM register stream in this song type");
+			return YMFALSE;
+		}
+		if ((!bMusicOk) || (bPause) || (innerSamplePos))
+		{
+			setLastError("Not playing, or not on a frame boundary");
+			return YMFALSE;
+		}
+
+		const ymint vblNbSample = replayRate/playerRate;
+		for (ymint i=0;(i<nbFrames) && (!bMusicOver);i++)
+		{	// what update() does, for a whole frame
+			player();
+			ymChip.skip(vblNbSample);
+		}
+		return YMTRUE;
+}
+
+void	CYmMusic::saveState(ymPlayerState_t *pState) const
+{
+		pState->chip.copyState(ymChip);
+		pState->currentFrame = currentFrame;
+		pState->innerSamplePos = innerSamplePos;
+		pState->bMusicOver = bMusicOver;
+}
+
+// The drums the chip may be playing are the ones of the saved instance,
+// keep it loaded for as long as this one plays.
+void	CYmMusic::restoreState(const ymPlayerState_t *pState)
+{
+		ymChip.copyState(pState->chip);
+		currentFrame = pState->currentFrame;
+		innerSamplePos = pState->innerSamplePos;
+		bMusicOver = pState->bMusicOver;
+}
+
+ymbool	CYmMusic::skipFrames(ymint nbFrames)
+{
+		if ((songType < YM_V2) || (songType >= YM_VMAX))
+		{
+			setLastError("No YM register stream in this song type");
+			return YMFALSE;
+		}
+		if ((!bMusicOk) || (bPause))
+		{
+			setLastError("Not playing");
+			return YMFALSE;
+		}
+
+		const ymint vblNbSample = (playerRate > 0) ? replayRate/playerRate : 0;
+		for (ymint i=0;(i<nbFrames) && (!bMusicOver);i++)
+		{	// what stepFrameEvents() does, but for the events
+			ymChip.resetCurrentSample();
+			player();
+			ymChip.effectSkip(vblNbSample);
+		}
+		return YMTRUE;
+}
+
+ymint	CYmMusic::captureFrames(ymint start,ymint count,ymFrameSink_t sink,void *pUser,ymbool bEvents)
+{
+		if ((songType < YM_V2) || (songType >= YM_VMAX))
+		{
+			setLastError("No YM register stream in this song type");
+			return 0;
+		}
+		if (bEvents)
+		{
+			if ((start != currentFrame) || (bMusicOver))
+			{
+				setLastError("Effect events only follow on from where the chip is");
+				return 0;
+			}
+		}
+		else
+		{
+			currentFrame = start;
+			bMusicOver = (start > nbFrame);
+		}
+
+		ymEffectEvent_t *pEvents = NULL;
+		ymint maxEvents = 0;
+		if ((bEvents) && (playerRate > 0))
+		{
+			maxEvents = (replayRate/playerRate+1)*YM_EFFECT_WRITES_PER_SAMPLE;
+			pEvents = (ymEffectEvent_t*)arena.alloc(maxEvents*sizeof(ymEffectEvent_t));
+			if (!pEvents)
+			{
+				setLastError("MALLOC Error");
+				return 0;
+			}
+		}
+
+		// nbFrame is the last one, the song doesn't loop
+		const ymbool bLoopMode = bLoop;
+		bLoop = YMFALSE;
+		ymCurrentSample_t writes;
+		ymint nbEvents = 0;
+		ymint n = 0;
+		for (;n<count;n++)
+		{
+			const ymint frame = (currentFrame < nbFrame) ? currentFrame : nbFrame;
+			if (!(bEvents ? stepFrameEvents(&writes,pEvents,maxEvents,&nbEvents) : stepFrame(&writes)))
+				break;
+			sink(pUser,frame,&writes,pEvents,nbEvents);
+		}
+		bLoop = bLoopMode;
+		arena.release(pEvents);
+		return n;
+}
+
+//-------------------------------------------------------------
+// Run the player for exactly one frame (VBL), without calling the
+// YM emulation at all. Only the register writes done by the player
+// are reported, which is all a register dump needs.
+// Returns YMFALSE when no frame has been played (music over, paused,
+// or a DigiMix/Tracker song that has no YM register stream).
+//-------------------------------------------------------------
+ymbool	CYmMusic::stepFrame(ymCurrentSample_t *pWrites)
+{
+
+		if ((!bMusicOk) ||
+			(bPause) ||
+			(bMusicOver))
+		{
+			return YMFALSE;
+		}
+
+		if ((songType < YM_V2) || (songType >= YM_VMAX))
+		{
+			setLastError("No YM register stream in this song type");
+			return YMFALSE;
+		}
+
+		ymChip.resetCurrentSample();
+		player();
+		if (pWrites)
+			*pWrites = *ymChip.getCurrentSample();
+
+		return YMTRUE;
+}
+
+//-------------------------------------------------------------
+// stepFrame(), then the SID, drums and sync buzzer the frame runs are
+// played over its samples: still no PCM, only the volume, mixer and
+// envelope shape writes they would take on a real chip, timed.
+//-------------------------------------------------------------
+ymbool	CYmMusic::stepFrameEvents(ymCurrentSample_t *pWrites,ymEffectEvent_t *pEvents,ymint maxEvents,ymint *pNbEvents)
+{
+		*pNbEvents = 0;
+		if (!stepFrame(pWrites))
+			return YMFALSE;
+
+		if (playerRate > 0)
+			*pNbEvents = ymChip.effectEvents(replayRate/playerRate,pEvents,maxEvents);
+		return YMTRUE;
+}
+
+//-------------------------------------------------------------
+// The register writes player() would do for the next frame, read
+// straight from the frame data: SID, drums and buzzer only ever act
+// on the chip as it renders, so they never show in the writes.
+// Neither the player effects nor the chip are run (the chip is only
+// reset at the end, as player() does), so don't mix with update().
+//-------------------------------------------------------------
+ymbool	CYmMusic::stepFrameDirect(ymu8 *pRegisters,ymu16 *pWritten)
+{
+
+		if ((!bMusicOk) ||
+			(bPause) ||
+			(bMusicOver))
+		{
+			return YMFALSE;
+		}
+
+		if ((songType < YM_V2) || (songType >= YM_VMAX))
+		{
+			setLastError("No YM register stream in this song type");
+			return YMFALSE;
+		}
+
+		if (currentFrame<0) currentFrame = 0;
+
+		if (currentFrame>=nbFrame)
+		{
+			if (bLoop)
+			{
+				currentFrame = loopFrame;
+			}
+			else
+			{	// the writes of the chip reset
+				bMusicOver = YMTRUE;
+				ymChip.resetCurrentSample();
+				ymChip.reset();
+				const ymCurrentSample_t *pReset = ymChip.getCurrentSample();
+				*pWritten = 0;
+				for (ymint i=0;i<YMNUMREGISTERS;i++)
+				{
+					pRegisters[i] = (pReset->registers[i] >= 0) ? pReset->registers[i] : 0;
+					if (pReset->registers[i] >= 0)
+						*pWritten |= (1<<i);
+				}
+				return YMTRUE;
+			}
+		}
+
+		memset(pRegisters,0,YMNUMREGISTERS);
+		*pWritten = frameRegisters(streamFrame(currentFrame),pRegisters);
+
+		currentFrame++;
+		return YMTRUE;
+}
+
+//-------------------------------------------------------------
+// The registers a YM2 to YM6 frame writes, returns their mask.
+//-------------------------------------------------------------
+ymu16	CYmMusic::frameRegisters(const ymu8 *ptr,ymu8 *pRegisters)
+{
+		memcpy(pRegisters,ptr,11);
+		ymu16 written = 0x07ff;		// 0 to 10, always
+
+		if (songType == YM_V2)		// MADMAX specific !
+		{
+			if (ptr[13]!=0xff)
+			{
+				pRegisters[11] = ptr[11];
+				pRegisters[12] = 0;
+				pRegisters[13] = 10;
+				written |= 0x3800;
+			}
+			if (ptr[10]&0x80)		// digi-drum: tone and noise of voice C cut
+				pRegisters[7] |= 0x24;
+		}
+		else
+		{
+			pRegisters[11] = ptr[11];
+			pRegisters[12] = ptr[12];
+			written |= 0x1800;
+			if (ptr[13]!=0xff)
+			{
+				pRegisters[13] = ptr[13];
+				written |= 0x2000;
+			}
+		}
+		return written;
+}
+
 
 void	CYmMusic::readYm6Effect(unsigned char *pReg,ymint code,ymint prediv,ymint count)
 {
@@ -393,10 +773,11 @@ void	CYmMusic::player(void)
 		}
 	}
 
-	ptr = pDataStream+currentFrame*streamInc;
+	ptr = streamFrame(currentFrame);
+	ymChip.setFrame(currentFrame);
 
-	for (ymint i=0;i<=10;i++)
-		ymChip.writeRegister(i,ptr[i]);
+	ymu8 frameRegs[YMNUMREGISTERS];
+	ymChip.writeRegisters(frameRegs,frameRegisters(ptr,frameRegs));
 
 	ymChip.sidStop(0);
 	ymChip.sidStop(1);
@@ -408,17 +789,10 @@ void	CYmMusic::player(void)
 	//---------------------------------------------
 	if (songType == YM_V2)		// MADMAX specific !
 	{
-		if (ptr[13]!=0xff)
-		{
-			ymChip.writeRegister(11,ptr[11]);
-			ymChip.writeRegister(12,0);
-			ymChip.writeRegister(13,10);				// MADMAX specific !!
-		}
 		if (ptr[10]&0x80)					// bit 7 volume canal C pour annoncer une digi-drum madmax.
 		{
 			ymint	sampleNum;
 			ymu32 sampleFrq;
-			ymChip.writeRegister(7,ymChip.readRegister(7)|0x24)	;	// Coupe TONE + NOISE canal C.
 			sampleNum = ptr[10]&0x7f;		// Numero du sample
 
 			if (ptr[12])
@@ -431,63 +805,53 @@ void	CYmMusic::player(void)
 			}
 		}
 	}
-	else if (songType >= YM_V3)
+	else if (songType >= YM_V5)
 	{
-		ymChip.writeRegister(11,ptr[11]);
-		ymChip.writeRegister(12,ptr[12]);
-		if (ptr[13]!=0xff)
-		{
-			ymChip.writeRegister(13,ptr[13]);
-		}
+		ymint code;
 
-		if (songType >= YM_V5)
+		if (songType == YM_V6)
 		{
-			ymint code;
+			readYm6Effect(ptr,1,6,14);
+			readYm6Effect(ptr,3,8,15);
+		}
+		else
+		{	// YM5 effect decoding
 
-			if (songType == YM_V6)
+		//------------------------------------------------------
+		// Sid Voice !!
+		//------------------------------------------------------
+			code = (ptr[1]>>4)&3;
+			if (code!=0)
 			{
-				readYm6Effect(ptr,1,6,14);
-				readYm6Effect(ptr,3,8,15);
+				ymu32 tmpFreq;
+				voice = code-1;
+				prediv = mfpPrediv[(ptr[6]>>5)&7];
+				prediv *= ptr[14];
+				tmpFreq = 0;
+				if (prediv)
+				{
+					tmpFreq = 2457600L / prediv;
+					ymChip.sidStart(voice,tmpFreq,ptr[voice+8]&15);
+				}
 			}
-			else
-			{	// YM5 effect decoding
 
-			//------------------------------------------------------
-			// Sid Voice !!
-			//------------------------------------------------------
-				code = (ptr[1]>>4)&3;
-				if (code!=0)
+		//------------------------------------------------------
+		// YM5 Digi Drum.
+		//------------------------------------------------------
+			code = (ptr[3]>>4)&3;
+			if (code!=0)
+			{	// Ici un digidrum demarre sur la voie voice.
+				voice = code-1;
+				ndrum = ptr[8+voice]&31;
+				if ((ndrum>=0) && (ndrum<nbDrum))
 				{
-					ymu32 tmpFreq;
-					voice = code-1;
-					prediv = mfpPrediv[(ptr[6]>>5)&7];
-					prediv *= ptr[14];
-					tmpFreq = 0;
+					ymu32 sampleFrq;
+					prediv = mfpPrediv[(ptr[8]>>5)&7];
+					prediv *= ptr[15];
 					if (prediv)
 					{
-						tmpFreq = 2457600L / prediv;
-						ymChip.sidStart(voice,tmpFreq,ptr[voice+8]&15);
-					}
-				}
-
-			//------------------------------------------------------
-			// YM5 Digi Drum.
-			//------------------------------------------------------
-				code = (ptr[3]>>4)&3;
-				if (code!=0)
-				{	// Ici un digidrum demarre sur la voie voice.
-					voice = code-1;
-					ndrum = ptr[8+voice]&31;
-					if ((ndrum>=0) && (ndrum<nbDrum))
-					{
-						ymu32 sampleFrq;
-						prediv = mfpPrediv[(ptr[8]>>5)&7];
-						prediv *= ptr[15];
-						if (prediv)
-						{
-							sampleFrq = MFP_CLOCK / prediv;
-							ymChip.drumStart(voice,pDrumTab[ndrum].pData,pDrumTab[ndrum].size,sampleFrq);
-						}
+						sampleFrq = MFP_CLOCK / prediv;
+						ymChip.drumStart(voice,pDrumTab[ndrum].pData,pDrumTab[ndrum].size,sampleFrq);
 					}
 				}
 			}
@@ -559,7 +923,7 @@ void	CYmMusic::computeTimeInfo(void)
 	//-------------------------------------------
 	// Parse all mixblock keys
 	//-------------------------------------------
-	m_pTimeInfo = (TimeKey*)malloc(sizeof(TimeKey) * m_nbTimeKey);
+	m_pTimeInfo = (TimeKey*)arena.table(sizeof(TimeKey) * m_nbTimeKey);
 	TimeKey *pKey = m_pTimeInfo;
 	ymu32 time = 0;
 
@@ -642,41 +1006,31 @@ void	CYmMusic::stDigitMix(ymsample *pWrite16,ymint nbs)
 
 void	CYmMusic::ymTrackerDesInterleave(void)
 {
-unsigned char *a0,*a1,*a2;
 unsigned char *pNewBuffer;
 ymint	step;
-ymu32 n1,n2;
 
 
 		if (attrib&A_STREAMINTERLEAVED)
 		{
-			a0 = pDataStream;
 			ymint size = sizeof(ymTrackerLine_t)*nbVoice*nbFrame;
-			pNewBuffer = (unsigned char*)malloc(size);
-			step = sizeof(ymTrackerLine_t)*nbVoice;
-			n1 = step;
-			a2 = pNewBuffer;
-			do
+			pNewBuffer = (unsigned char*)arena.alloc(size);
+			if (!pNewBuffer)
 			{
-				n2 = nbFrame;
-				a1 = a2;
-				do
-				{
-					*a1 = *a0++;
-					a1 += step;
-				}
-				while (--n2);
-				a2++;
+				setLastError("Malloc error in ymTrackerDesInterleave()\n");
+				return;
 			}
-			while (--n1);
-			memcpy(pDataStream,pNewBuffer,size);
-			free(pNewBuffer);
+			step = sizeof(ymTrackerLine_t)*nbVoice;
+			transposeBytes(pDataStream,pNewBuffer,step,nbFrame);
+			// play from the new buffer, no copy back (pBigMalloc may not be ours to write to)
+			arena.release(pStreamMalloc);
+			pStreamMalloc = pNewBuffer;
+			pDataStream = pNewBuffer;
 			attrib &= (~A_STREAMINTERLEAVED);
 		}
 }
 
 
-void	CYmMusic::ymTrackerInit(ymint volMaxPercent)
+ymbool	CYmMusic::ymTrackerInit(ymint volMaxPercent)
 {
 ymint i,s;
 ymint vol;
@@ -684,27 +1038,42 @@ ymint scale;
 ymsample *pTab;
 
 
+		if (!pTracker)
+		{
+			pTracker = (ymTrackerState_t*)malloc(sizeof(ymTrackerState_t));
+			if (!pTracker)
+			{
+				setLastError("MALLOC Failed !");
+				return YMFALSE;
+			}
+			pTracker->volumeScale = -1;
+		}
 
 		for (i=0;i<MAX_VOICE;i++)
-			ymTrackerVoice[i].bRunning = 0;
+			pTracker->voice[i].bRunning = 0;
 
-		ymTrackerNbSampleBefore = 0;
+		pTracker->nbSampleBefore = 0;
 
 		scale = (256*volMaxPercent) / (nbVoice*100);
-		pTab = ymTrackerVolumeTable;
-
-		// Construit la table de volume.
-		for (vol=0;vol<64;vol++)
+		if (scale != pTracker->volumeScale)
 		{
-			for (s=-128;s<128;s++)
+			pTab = pTracker->volumeTable;
+
+			// Construit la table de volume.
+			for (vol=0;vol<64;vol++)
 			{
-				*pTab++ = (s*(ymint)scale*vol)/64;
+				for (s=-128;s<128;s++)
+				{
+					*pTab++ = (s*(ymint)scale*vol)/64;
+				}
 			}
+			pTracker->volumeScale = scale;
 		}
 
 		// Des-interleave si necessaire.
 		ymTrackerDesInterleave();
 
+		return YMTRUE;
 }
 
 
@@ -766,7 +1135,7 @@ double	step;
 
 		if (!(pVoice->bRunning)) return;
 
-		pVolumeTab = &ymTrackerVolumeTable[256*(pVoice->sampleVolume&63)];
+		pVolumeTab = &pTracker->volumeTable[256*(pVoice->sampleVolume&63)];
 		pSample = pVoice->pSample;
 		samplePos = pVoice->samplePos;
 
@@ -819,22 +1188,22 @@ ymint _nbs;
 
 		do
 		{
-			if (ymTrackerNbSampleBefore == 0)
+			if (pTracker->nbSampleBefore == 0)
 			{
 				// Lit la partition ymTracker
-				ymTrackerPlayer(ymTrackerVoice);
+				ymTrackerPlayer(pTracker->voice);
 				if (bMusicOver) return;
-				ymTrackerNbSampleBefore = replayRate / playerRate;
+				pTracker->nbSampleBefore = replayRate / playerRate;
 			}
-			_nbs = ymTrackerNbSampleBefore;		// nb avant playerUpdate.
+			_nbs = pTracker->nbSampleBefore;		// nb avant playerUpdate.
 			if (_nbs>nbSample) _nbs = nbSample;
-			ymTrackerNbSampleBefore -= _nbs;
+			pTracker->nbSampleBefore -= _nbs;
 			if (_nbs>0)
 			{
 				// Genere les samples.
 				for (i=0;i<nbVoice;i++)
 				{
-					ymTrackerVoiceAdd(&ymTrackerVoice[i],pBuffer,_nbs);
+					ymTrackerVoiceAdd(&pTracker->voice[i],pBuffer,_nbs);
 				}
 				pBuffer += _nbs;
 				nbSample -= _nbs;
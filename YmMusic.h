@@ -45,10 +45,16 @@
 #include "digidrum.h"
 
 #define	MAX_DIGIDRUM	128
+#define	YM_STREAM_WINDOW	256		// frames depacked at a time when streaming a packed song
+
+class	CLzhDepacker;
 
 #define	YMTPREC		16
 #define	MAX_VOICE	8
 
+#define	WAVE_HEADER_SIZE	44
+#define	WAVE_BLOCK_SAMPLES	(512*1024)		// rendered and written at once by waveCreate()
+
 typedef enum
 {
 	YM_V2,
@@ -113,6 +119,25 @@ typedef struct
 	ymu8 freqLow;
 } ymTrackerLine_t;
 
+// Only YM-Tracker songs need it, made by the first one an instance loads.
+typedef struct
+{
+	ymTrackerVoice_t	voice[MAX_VOICE];
+	ymint				nbSampleBefore;
+	ymint				volumeScale;		// the one volumeTable was worked out for
+	ymsample			volumeTable[256*64];
+} ymTrackerState_t;
+
+
+// Where a YM2 to YM6 song is at, chip included, see saveState().
+typedef struct
+{
+	CYm2149Ex	chip;
+	ymint		currentFrame;
+	ymint		innerSamplePos;
+	ymbool		bMusicOver;
+} ymPlayerState_t;
+
 
 enum
 {
@@ -124,6 +149,48 @@ enum
 };
 
 
+//-------------------------------------------------------------
+// What an instance allocates for its songs, kept between them so that
+// loading song after song in the same instance doesn't go back to
+// malloc() each time.  alloc() buffers (the file, depacked or
+// de-interleaved stream) are kept as spares by release() and the
+// smallest one that is big enough is handed out again; table() ones
+// (drum tables, MIX1 blocks, names) are carved out of a block that
+// reset() empties at once.  purge() really frees it all.
+//-------------------------------------------------------------
+#define	YM_ARENA_SPARES		4
+#define	YM_ARENA_BLOCK		4096
+
+class	CYmArena
+{
+public:
+	CYmArena();
+	~CYmArena();
+
+	void	*alloc(ymu32 size);
+	void	*grow(void *pBuffer,ymu32 size);	// as realloc()
+	void	release(void *pBuffer);
+	void	*table(ymu32 size);
+	ymchar	*string(const char *pIn);
+	void	reset(void);
+	void	purge(void);
+
+private:
+	struct	Block
+	{
+		Block	*pNext;
+		ymu32	size;
+		ymu32	used;
+	};
+
+	static	ymu32	capacity(const void *pBuffer);
+
+	void	*pSpare[YM_ARENA_SPARES];
+	ymint	nbSpare;
+	Block	*pBlocks;
+};
+
+
 class	CYmMusic
 {
 
@@ -133,10 +200,15 @@ public:
 
 	ymbool	load(const char *pName);
 	ymbool	loadMemory(void *pBlock,ymu32 size);
+	ymbool	loadMemoryNoCopy(void *pBlock,ymu32 size);		// pBlock must stay valid until unLoad()
 
-	void	unLoad(void);
+	void	unLoad(void);				// buffers kept for the next song, see CYmArena
+	void	trim(void);					// unLoad() and those freed
 	ymbool	isSeekable(void);
 	ymbool	update(ymsample *pBuffer,ymint nbSample);
+	ymbool	stepFrame(ymCurrentSample_t *pWrites);
+	ymbool	stepFrameEvents(ymCurrentSample_t *pWrites,ymEffectEvent_t *pEvents,ymint maxEvents,ymint *pNbEvents);
+	ymbool	stepFrameDirect(ymu8 *pRegisters,ymu16 *pWritten);
 	ymu32	getPos(void);
 	ymu32	getMusicTime(void);
 	ymu32	setMusicTime(ymu32 time);
@@ -151,11 +223,19 @@ public:
 	const char	*getLastError(void);
 	int		readYmRegister(ymint reg)			{ return ymChip.readRegister(reg); }
 	void	setLowpassFilter(ymbool bActive)	{ ymChip.setFilter(bActive); }
+	const ymCurrentSample_t	*getCurrentSample(void) const	{ return ymChip.getCurrentSample(); }
+	void	resetCurrentSample(void)			{ ymChip.resetCurrentSample(); }
+	void	setRegisterObserver(ymRegisterObserver_t pObserver,void *pUser)	{ ymChip.setRegisterObserver(pObserver,pUser); }
+	void	setFrameObserver(ymFrameObserver_t pObserver,void *pUser)	{ ymChip.setFrameObserver(pObserver,pUser); }
+	void	setStats(ymStats_t *_pStats)		{ pStats = _pStats; }
 
 	ymbool		getMusicOver(void)	const	{ return (bMusicOver); }
 	ymint		GetNbFrame()		const	{ return nbFrame; }
+	ymint		GetLoopFrame()		const	{ return loopFrame; }
 	ymint		GetStreamInc()		const	{ return streamInc; }
-	const ymu8*	GetDataStream()		const	{ return pDataStream; }
+	const ymu8*	GetDataStream()		const	{ return (pStreamDepacker) ? NULL : pDataStream; }	// NULL when streaming
+	ymbool		isStreaming()		const	{ return (NULL != pStreamDepacker); }
+	ymbool		hasRegisterStream()	const	{ return (songType >= YM_V2) && (songType < YM_VMAX); }
 	
 	
 	CYm2149Ex* chip() {return &ymChip;}
@@ -164,7 +244,32 @@ public:
 //-------------------------------------------------------------
 // WAVE Generator
 //-------------------------------------------------------------
-	int		waveCreate(char *fName);
+	int		waveCreate(char *fName);		// the rest of the song, without loop
+	void	waveHeader(ymu8 *pHeader,ymu32 nbSample) const;	// WAVE_HEADER_SIZE bytes for nbSample of update()
+
+//-------------------------------------------------------------
+// Checkpoints, YM2 to YM6 songs: a state saved from one instance can
+// be restored in another one that has the same song loaded, so that
+// parts of a song render side by side.  fastForward() runs nbFrames
+// whole frames of update() without any output, only the DC adjuster
+// (the last DC_ADJUST_BUFFERLEN samples) isn't up to date after it.
+//-------------------------------------------------------------
+	ymbool	fastForward(ymint nbFrames);
+	void	saveState(ymPlayerState_t *pState) const;
+	void	restoreState(const ymPlayerState_t *pState);
+
+//-------------------------------------------------------------
+// Frame captures, YM2 to YM6 songs: what stepFrame() (or, bEvents,
+// stepFrameEvents()) reports for frames start to start+count-1, one
+// frame at a time to sink, frame nbFrame being the chip reset at the
+// end; returns how many there were.  The writes of a frame only depend
+// on its data, so they can start anywhere, but effect events carry on
+// from the frames before (SID phases, drums still playing): the chip
+// has to be at start already, from a checkpoint that skipFrames()
+// gets to the way stepFrameEvents() would, without the events.
+//-------------------------------------------------------------
+	ymint	captureFrames(ymint start,ymint count,ymFrameSink_t sink,void *pUser,ymbool bEvents);
+	ymbool	skipFrames(ymint nbFrames);
 
 	ymbool	bMusicOver;
 
@@ -177,10 +282,22 @@ private:
 	void	setLastError(const char *pError);
 	ymu8 *depackFile(ymu32 size);
 	ymbool	deInterleave(void);
+	static void	transposeBytes(const ymu8 *pSrc,ymu8 *pDst,ymint rows,ymint cols);
+	ymbool	loadBigMalloc(void);
+	ymbool	mapFile(const char *fileName);
+	void	releaseBigMalloc(void);
+	ymu8	*depackStreamHead(CLzhDepacker *pDepacker,ymu32 *pHeadSize);
+	ymu8	*streamFrame(ymint frame);
+	void	streamRewind(void);
+	void	streamClose(void);
 	void	readYm6Effect(ymu8 *pReg,int code,int prediv,int count);
 	void	player(void);
+	ymu16	frameRegisters(const ymu8 *ptr,ymu8 *pRegisters);
 	void	setTimeControl(ymbool bFlag);
+	uint64_t	statsClock(void) const;		// ns, 0 without stats
+
 
+	ymStats_t	*pStats;
 
 	CYm2149Ex	ymChip;
 	const char	*pLastError;
@@ -192,7 +309,25 @@ private:
 	digiDrum_t *pDrumTab;
 	int		musicTime;
 	ymu8 *pBigMalloc;
+	ymbool	bBigMallocBorrowed;		// not ours to free: mapped file or loadMemoryNoCopy() block
+	ymu32	bigMallocMapSize;		// non zero if pBigMalloc is a file mapping
+	ymu8 *pStreamMalloc;			// de-interleaved stream, when pBigMalloc has to be kept
+	ymbool	bDrumBorrowed;			// pDrumTab datas point into pBigMalloc
+	ymbool	bDrumCached;			// pDrumTab datas are shared 4 bits drums, see Ymload.cpp
 	ymu8 *pDataStream;
+
+	// Packed non-interleaved YM5/YM6: pBigMalloc only holds the song header,
+	// frames are depacked YM_STREAM_WINDOW at a time as the player gets to them.
+	CLzhDepacker *pStreamDepacker;
+	ymu8	*pStreamFile;			// the packed file, what pBigMalloc was
+	ymbool	bStreamFileBorrowed;
+	ymu32	streamFileMapSize;
+	ymu8	*pStreamSrc;			// LH5 data in pStreamFile
+	ymu32	streamSrcSize;
+	ymu32	streamHeadSize;			// bytes before the first frame
+	ymu8	*pStreamWindow;
+	ymint	streamWindowFrame;
+	ymint	streamWindowNbFrame;
 	ymbool	bLoop;
 	ymint	fileSize;
 	ymbool	ymDecode(void);
@@ -223,6 +358,7 @@ private:
 	mixBlock_t *pMixBlock;
 	ymint	mixPos;
 	ymu8 *pBigSampleBuffer;
+	ymbool	bBigSampleBufferBorrowed;	// points into pBigMalloc
 	ymu8	*pCurrentMixSample;
 	ymu32	currentSampleLength;
 	ymu32	currentPente;
@@ -245,18 +381,19 @@ private:
 //-------------------------------------------------------------
 // YM-Universal-Tracker
 //-------------------------------------------------------------
-	void	ymTrackerInit(int volMaxPercent);
+	ymbool	ymTrackerInit(int volMaxPercent);
 	void	ymTrackerUpdate(ymsample *pBuffer,int nbSample);
 	void	ymTrackerDesInterleave(void);
 	void	ymTrackerPlayer(ymTrackerVoice_t *pVoice);
 	void	ymTrackerVoiceAdd(ymTrackerVoice_t *pVoice,ymsample *pBuffer,int nbs);
 
 	int			nbVoice;
-	ymTrackerVoice_t	ymTrackerVoice[MAX_VOICE];
-	int					ymTrackerNbSampleBefore;
-	ymsample			ymTrackerVolumeTable[256*64];
+	ymTrackerState_t	*pTracker;
 	int					ymTrackerFreqShift;
 
+	CYmArena	arena;
+	CLzhDepacker	*pSpareDepacker;		// the last one used, for the next packed song
+
 
 };
 
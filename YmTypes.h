@@ -100,6 +100,37 @@ typedef struct {
 	
 } ymCurrentSample_t;
 
+// A write the SID, digidrum or sync buzzer effects make within a frame,
+// sample being the number of samples (at the replay rate) since its start.
+typedef struct {
+	ymu16 sample;
+	ymu8 reg;
+	ymu8 value;
+} ymEffectEvent_t;
+
+// the most effect writes in one sample: 3 volumes, mixer and envelope shape
+#define YM_EFFECT_WRITES_PER_SAMPLE	5
+
+// Called by a chip for each register write, frame being the player frame (VBL) index.
+typedef void (*ymRegisterObserver_t)(void *pUser,ymu32 frame,ymint reg,ymint value);
+
+// Called once per batch of writes instead, bit N of mask set when pRegisters[N] is written.
+typedef void (*ymFrameObserver_t)(void *pUser,ymu32 frame,const ymu8 *pRegisters,ymu16 mask);
+
+// Given each frame CYmMusic::captureFrames() plays: its writes, then the effect writes within it.
+typedef void (*ymFrameSink_t)(void *pUser,ymu32 frame,const ymCurrentSample_t *pWrites,const ymEffectEvent_t *pEvents,ymint nbEvents);
+
+//-----------------------------------------------------------
+// Library traces (register reads and writes...) on stderr, compiled
+// out unless built with -DYM_TRACE: the player calls them every frame.
+//-----------------------------------------------------------
+#ifdef YM_TRACE
+#include <stdio.h>
+#define	YM_TRACE_PRINTF(...)	fprintf(stderr,__VA_ARGS__)
+#else
+#define	YM_TRACE_PRINTF(...)	do {} while (0)
+#endif
+
 
 #endif
 
@@ -39,18 +39,6 @@
 #include "StSoundLibrary.h"
 
 
-ymCurrentSample_t  YMCurrentSample;
-
-
-void ymResetCurrentSample() {
-
-		for (int i=0; i<YMNUMREGISTERS; i++) {
-			YMCurrentSample.registers[i] = -1;
-		}
-		YMCurrentSample.ready = 0;
-}
-
-
 // Static assert to check various type len
 
 YMMUSIC	* ymMusicCreate()
@@ -58,6 +46,11 @@ YMMUSIC	* ymMusicCreate()
 	return (YMMUSIC*)(new CYmMusic);
 }
 
+YMMUSIC	* ymMusicCreateWithRate(ymint replayRate)
+{
+	return (YMMUSIC*)(new CYmMusic(replayRate));
+}
+
 
 ymbool ymMusicLoad(YMMUSIC *pMus, const char *fName)
 {
@@ -71,18 +64,67 @@ ymbool ymMusicLoadMemory(YMMUSIC *pMus, void *pBlock, ymu32 size)
 	return pMusic->loadMemory(pBlock,size);
 }
 
+ymbool ymMusicLoadMemoryNoCopy(YMMUSIC *pMus, void *pBlock, ymu32 size)
+{
+	CYmMusic *pMusic = (CYmMusic*)pMus;
+	return pMusic->loadMemoryNoCopy(pBlock,size);
+}
+
 void ymMusicDestroy(YMMUSIC *pMus)
 {
 	CYmMusic *pMusic = (CYmMusic*)pMus;
 	delete pMusic;
 }
 
+void ymMusicUnload(YMMUSIC *pMus)
+{
+	CYmMusic *pMusic = (CYmMusic*)pMus;
+	pMusic->stop();
+	pMusic->unLoad();
+}
+
+void ymMusicTrim(YMMUSIC *pMus)
+{
+	CYmMusic *pMusic = (CYmMusic*)pMus;
+	pMusic->trim();
+}
+
 ymbool ymMusicCompute(YMMUSIC *_pMus, ymsample *pBuffer, int nbSample)
 {
 	CYmMusic *pMusic = (CYmMusic*)_pMus;
 	return pMusic->update(pBuffer,nbSample);
 }
 
+ymbool ymMusicWaveCreate(YMMUSIC *_pMus, char *fName)
+{
+	CYmMusic *pMusic = (CYmMusic*)_pMus;
+	return pMusic->waveCreate(fName);
+}
+
+ymbool ymMusicStepFrame(YMMUSIC *_pMus, ymCurrentSample_t *pWrites)
+{
+	CYmMusic *pMusic = (CYmMusic*)_pMus;
+	return pMusic->stepFrame(pWrites);
+}
+
+ymbool ymMusicStepFrameEvents(YMMUSIC *_pMus, ymCurrentSample_t *pWrites, ymEffectEvent_t *pEvents, ymint maxEvents, ymint *pNbEvents)
+{
+	CYmMusic *pMusic = (CYmMusic*)_pMus;
+	return pMusic->stepFrameEvents(pWrites,pEvents,maxEvents,pNbEvents);
+}
+
+ymbool ymMusicStepFrameDirect(YMMUSIC *_pMus, ymu8 *pRegisters, ymu16 *pWritten)
+{
+	CYmMusic *pMusic = (CYmMusic*)_pMus;
+	return pMusic->stepFrameDirect(pRegisters,pWritten);
+}
+
+void ymMusicSetStats(YMMUSIC *_pMus, ymStats_t *pStats)
+{
+	CYmMusic *pMusic = (CYmMusic*)_pMus;
+	pMusic->setStats(pStats);
+}
+
 void ymMusicSetLoopMode(YMMUSIC *_pMus, ymbool bLoop)
 {
 	CYmMusic *pMusic = (CYmMusic*)_pMus;
@@ -158,6 +200,30 @@ void ymMusicRestart(YMMUSIC *_pMus)
 	pMusic->restart();
 }
 
+const ymCurrentSample_t * ymMusicGetCurrentSample(YMMUSIC *_pMus)
+{
+	CYmMusic *pMusic = (CYmMusic*)_pMus;
+	return pMusic->getCurrentSample();
+}
+
+void ymMusicResetCurrentSample(YMMUSIC *_pMus)
+{
+	CYmMusic *pMusic = (CYmMusic*)_pMus;
+	pMusic->resetCurrentSample();
+}
+
+void ymMusicSetRegisterObserver(YMMUSIC *_pMus, ymRegisterObserver_t pObserver, void *pUser)
+{
+	CYmMusic *pMusic = (CYmMusic*)_pMus;
+	pMusic->setRegisterObserver(pObserver,pUser);
+}
+
+void ymMusicSetFrameObserver(YMMUSIC *_pMus, ymFrameObserver_t pObserver, void *pUser)
+{
+	CYmMusic *pMusic = (CYmMusic*)_pMus;
+	pMusic->setFrameObserver(pObserver,pUser);
+}
+
 void ymMusicSetLowpassFiler(YMMUSIC *_pMus, ymbool bActive)
 {
 	CYmMusic *pMusic = (CYmMusic*)_pMus;
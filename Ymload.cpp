@@ -40,6 +40,23 @@
 #include <string.h>
 #include "YmMusic.h"
 #include "LZH/LZH.H"
+#include <mutex>
+#include <unordered_map>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define YM_MMAP			// map files rather than read them in
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define YM_SSE2
+#include <emmintrin.h>
+#endif
+
+#define	TRANSPOSE_TILE	64			// frames per tile, so a tile of every plane stays in L1
 
 static	ymu16 ymVolumeTable[16] =
 {	62,161,265,377,580,774,1155,1575,2260,3088,4570,6233,9330,13187,21220,32767};
@@ -58,13 +75,223 @@ static	void	signeSample(ymu8 *ptr,yms32 size)
 		}
 }
 
-char	*mstrdup(const char *in)
+//-------------------------------------------------------------
+// 4 bits digidrums, converted to 8 bits: one copy per content, shared
+// by every instance that loads it (the same song over and over in a
+// batch, the per segment instances of a render) until the last one
+// unloads.  Keyed by a hash of the converted samples, which is worked
+// out from the 4 bits ones without converting them first.
+//-------------------------------------------------------------
+typedef struct
+{
+	ymu32	size;
+	ymint	refs;
+	ymu8	*pData;
+} cachedDrum_t;
+
+static	std::mutex	drumCacheMutex;
+static	std::unordered_multimap<uint64_t,cachedDrum_t>	drumCache;
+
+static	inline ymu8	drum4To8(ymu8 sample)
+{
+		return ymVolumeTable[sample&15]>>7;
+}
+
+static	uint64_t	drumHash(const ymu8 *pData,ymu32 size,ymbool b4Bits)
+{
+		uint64_t hash = 14695981039346656037ULL ^ size;
+		for (ymu32 i=0;i<size;i++)
+			hash = (hash ^ (b4Bits ? drum4To8(pData[i]) : pData[i])) * 1099511628211ULL;
+		return hash;
+}
+
+static	ymu8	*drumCacheAcquire(const ymu8 *p4Bits,ymu32 size)
+{
+		const uint64_t hash = drumHash(p4Bits,size,YMTRUE);
+		std::lock_guard<std::mutex> lock(drumCacheMutex);
+		auto range = drumCache.equal_range(hash);
+		for (auto it=range.first;it!=range.second;++it)
+		{
+			cachedDrum_t &drum = it->second;
+			if (drum.size != size)
+				continue;
+			ymu32 i = 0;
+			while ((i<size) && (drum.pData[i] == drum4To8(p4Bits[i])))
+				i++;
+			if (i == size)
+			{
+				drum.refs++;
+				return drum.pData;
+			}
+		}
+		cachedDrum_t drum;
+		drum.size = size;
+		drum.refs = 1;
+		drum.pData = (ymu8*)malloc(size);
+		if (!drum.pData)
+			return NULL;
+		for (ymu32 i=0;i<size;i++)
+			drum.pData[i] = drum4To8(p4Bits[i]);
+		drumCache.insert(std::make_pair(hash,drum));
+		return drum.pData;
+}
+
+static	void	drumCacheRelease(ymu8 *pData,ymu32 size)
+{
+		const uint64_t hash = drumHash(pData,size,YMFALSE);
+		std::lock_guard<std::mutex> lock(drumCacheMutex);
+		auto range = drumCache.equal_range(hash);
+		for (auto it=range.first;it!=range.second;++it)
+		{
+			if (it->second.pData == pData)
+			{
+				if (--it->second.refs == 0)
+				{
+					free(pData);
+					drumCache.erase(it);
+				}
+				return;
+			}
+		}
+}
+
+//-------------------------------------------------------------
+// CYmArena: alloc() buffers have their capacity in the 16 bytes just
+// before them, table() blocks are chained, the newest first.
+//-------------------------------------------------------------
+#define	ARENA_HEADER	16
+
+CYmArena::CYmArena()
+{
+		nbSpare = 0;
+		pBlocks = NULL;
+}
+
+CYmArena::~CYmArena()
+{
+		purge();
+}
+
+ymu32	CYmArena::capacity(const void *pBuffer)
 {
-	const int size = (int)strlen(in)+1;
-	char *out = (char*)malloc(size);
-	if (out)
-		strcpy(out,in);
-	return out;
+		return *(const ymu32*)((const ymu8*)pBuffer - ARENA_HEADER);
+}
+
+void	*CYmArena::alloc(ymu32 size)
+{
+		ymint best = -1;
+		for (ymint i=0;i<nbSpare;i++)
+		{
+			if ((capacity(pSpare[i]) >= size) && ((best < 0) || (capacity(pSpare[i]) < capacity(pSpare[best]))))
+				best = i;
+		}
+		if (best >= 0)
+		{
+			void *pBuffer = pSpare[best];
+			pSpare[best] = pSpare[--nbSpare];
+			return pBuffer;
+		}
+		ymu8 *pBlock = (ymu8*)malloc(size + ARENA_HEADER);
+		if (!pBlock)
+			return NULL;
+		*(ymu32*)pBlock = size;
+		return pBlock + ARENA_HEADER;
+}
+
+void	*CYmArena::grow(void *pBuffer,ymu32 size)
+{
+		if (!pBuffer)
+			return alloc(size);
+		const ymu32 old = capacity(pBuffer);
+		if (old >= size)
+			return pBuffer;
+		void *pNew = alloc(size);
+		if (pNew)
+		{
+			memcpy(pNew,pBuffer,old);
+			release(pBuffer);
+		}
+		return pNew;
+}
+
+void	CYmArena::release(void *pBuffer)
+{
+		if (!pBuffer)
+			return;
+		if (nbSpare < YM_ARENA_SPARES)
+		{
+			pSpare[nbSpare++] = pBuffer;
+			return;
+		}
+		// full, keep the biggest ones
+		ymint smallest = 0;
+		for (ymint i=1;i<nbSpare;i++)
+		{
+			if (capacity(pSpare[i]) < capacity(pSpare[smallest]))
+				smallest = i;
+		}
+		if (capacity(pBuffer) > capacity(pSpare[smallest]))
+		{
+			void *pOld = pSpare[smallest];
+			pSpare[smallest] = pBuffer;
+			pBuffer = pOld;
+		}
+		free((ymu8*)pBuffer - ARENA_HEADER);
+}
+
+void	*CYmArena::table(ymu32 size)
+{
+		size = (size + 15) & ~15;
+		if ((!pBlocks) || (pBlocks->size - pBlocks->used < size))
+		{
+			ymu32 blockSize = (pBlocks) ? pBlocks->size*2 : YM_ARENA_BLOCK;
+			if (blockSize < size)
+				blockSize = size;
+			Block *pBlock = (Block*)malloc(ARENA_HEADER + blockSize);
+			if (!pBlock)
+				return NULL;
+			pBlock->pNext = pBlocks;
+			pBlock->size = blockSize;
+			pBlock->used = 0;
+			pBlocks = pBlock;
+		}
+		void *pTable = (ymu8*)pBlocks + ARENA_HEADER + pBlocks->used;
+		pBlocks->used += size;
+		return pTable;
+}
+
+ymchar	*CYmArena::string(const char *pIn)
+{
+		const ymu32 size = (ymu32)strlen(pIn)+1;
+		ymchar *pOut = (ymchar*)table(size);
+		if (pOut)
+			memcpy(pOut,pIn,size);
+		return pOut;
+}
+
+// the newest block is the biggest one, only that one is kept
+void	CYmArena::reset(void)
+{
+		if (!pBlocks)
+			return;
+		Block *pBlock = pBlocks->pNext;
+		while (pBlock)
+		{
+			Block *pNext = pBlock->pNext;
+			free(pBlock);
+			pBlock = pNext;
+		}
+		pBlocks->pNext = NULL;
+		pBlocks->used = 0;
+}
+
+void	CYmArena::purge(void)
+{
+		reset();
+		free(pBlocks);
+		pBlocks = NULL;
+		while (nbSpare > 0)
+			free((ymu8*)pSpare[--nbSpare] - ARENA_HEADER);
 }
 
 ymu32      readMotorolaDword(ymu8 **ptr)
@@ -89,12 +316,12 @@ ymu8 *p = *ptr;
         return n;
 }
 
-ymchar    *readNtString(ymchar **ptr)
+ymchar    *readNtString(CYmArena &arena,ymu8 **ptr)
 {
 ymchar *p;
 
-		p = mstrdup(*ptr);
-		(*ptr) += strlen(*ptr)+1;
+		p = arena.string((const char*)*ptr);
+		(*ptr) += strlen((const char*)*ptr)+1;
         return p;
 }
 
@@ -118,6 +345,19 @@ yms32	ReadBigEndian32(ymu8 *pBig)
 	return v;
 }
 
+enum
+{
+	e_YM2a = ('Y' << 24) | ('M' << 16) | ('2' << 8) | ('!'),	//'YM2!'
+	e_YM3a = ('Y' << 24) | ('M' << 16) | ('3' << 8) | ('!'),	//'YM3!'
+	e_YM3b = ('Y' << 24) | ('M' << 16) | ('3' << 8) | ('b'),	//'YM3b'
+	e_YM4a = ('Y' << 24) | ('M' << 16) | ('4' << 8) | ('!'),	//'YM4!'
+	e_YM5a = ('Y' << 24) | ('M' << 16) | ('5' << 8) | ('!'),	//'YM5!'
+	e_YM6a = ('Y' << 24) | ('M' << 16) | ('6' << 8) | ('!'),	//'YM6!'
+	e_MIX1 = ('M' << 24) | ('I' << 16) | ('X' << 8) | ('1'),	//'MIX1'
+	e_YMT1 = ('Y' << 24) | ('M' << 16) | ('T' << 8) | ('1'),	//'YMT1'
+	e_YMT2 = ('Y' << 24) | ('M' << 16) | ('T' << 8) | ('2'),	//'YMT2'
+};
+
 unsigned char	*CYmMusic::depackFile(ymu32 checkOriginalSize)
  {
  lzhHeader_t *pHeader;
@@ -135,14 +375,7 @@ unsigned char	*CYmMusic::depackFile(ymu32 checkOriginalSize)
 		fileSize = (ymu32)-1;
 
 		fileSize = ReadLittleEndian32((ymu8*)&pHeader->original);
-		pNew = (ymu8*)malloc(fileSize);
-		if (!pNew)
-		{
-			setLastError("MALLOC Failed !");
-			free(pBigMalloc);
-			pBigMalloc = NULL;
-			return NULL;
-		}
+		pNew = NULL;
 
 		pSrc = pBigMalloc + pHeader->size;
 		ymu32		packedSize = ReadLittleEndian32((ymu8*)&pHeader->packed);
@@ -157,26 +390,66 @@ unsigned char	*CYmMusic::depackFile(ymu32 checkOriginalSize)
 		if (packedSize <= checkOriginalSize)
 		{
 			// alloc space for depacker and depack data
-			CLzhDepacker *pDepacker = new CLzhDepacker;
+			CLzhDepacker *pDepacker = pSpareDepacker;
+			pSpareDepacker = NULL;
+			if (!pDepacker)
+				pDepacker = new CLzhDepacker;
+
+			// songs that can be played as they are depacked only get their header depacked now
+			pDepacker->LzOpen(pSrc,packedSize,fileSize);
+			ymu32 headSize;
+			pNew = depackStreamHead(pDepacker,&headSize);
+			if (pNew)
+			{
+				pStreamDepacker = pDepacker;
+				pStreamSrc = pSrc;
+				streamSrcSize = packedSize;
+				streamHeadSize = headSize;
+				streamWindowFrame = 0;
+				streamWindowNbFrame = 0;
+				pStreamWindow = (ymu8*)arena.alloc(YM_STREAM_WINDOW*16);
+				// the packed data is read from until the end, keep it
+				pStreamFile = pBigMalloc;
+				bStreamFileBorrowed = bBigMallocBorrowed;
+				streamFileMapSize = bigMallocMapSize;
+				pBigMalloc = NULL;
+				bBigMallocBorrowed = YMFALSE;
+				bigMallocMapSize = 0;
+				if (!pStreamWindow)
+				{
+					setLastError("MALLOC Failed !");
+					arena.release(pNew);
+					streamClose();
+					return NULL;
+				}
+				return pNew;
+			}
+
+			pNew = (ymu8*)arena.alloc(fileSize);
+			if (!pNew)
+			{
+				setLastError("MALLOC Failed !");
+				delete pDepacker;
+				releaseBigMalloc();
+				return NULL;
+			}
 			const bool bRet = pDepacker->LzUnpack(pSrc,packedSize,pNew,fileSize);
-			delete pDepacker;
+			pSpareDepacker = pDepacker;
 
 			if (!bRet)
 			{	// depacking error
 				setLastError("LH5 Depacking Error !");
-				free(pNew);
+				arena.release(pNew);
 				pNew = NULL;
 			}
 		}
 		else
 		{
 			setLastError("LH5 Depacking Error !");
-			free(pNew);
-			pNew = NULL;
 		}
 
 		// Free up source buffer, whatever depacking fail or success
-		free(pBigMalloc);
+		releaseBigMalloc();
 
 		return pNew;
  }
@@ -185,6 +458,118 @@ unsigned char	*CYmMusic::depackFile(ymu32 checkOriginalSize)
 
 
 
+static ymbool	streamHeadGet(CYmArena &arena,CLzhDepacker *pDepacker,ymu8 **ppHead,ymu32 *pSize,ymu32 need)
+{
+		if (need <= *pSize)
+			return YMTRUE;
+		ymu8 *pHead = (ymu8*)arena.grow(*ppHead,need);
+		if (!pHead)
+			return YMFALSE;
+		*ppHead = pHead;
+		const int n = need - *pSize;
+		if (pDepacker->LzRead(pHead + *pSize,n) != n)
+			return YMFALSE;
+		*pSize = need;
+		return YMTRUE;
+}
+
+// Depack the header of a YM5/YM6 song whose frames can be depacked as they are
+// played (non-interleaved), up to the first frame.  NULL for any other song.
+ymu8	*CYmMusic::depackStreamHead(CLzhDepacker *pDepacker,ymu32 *pHeadSize)
+{
+ymu8	*pHead = NULL;
+ymu32	size = 0;
+ymu8	*ptr;
+
+		if (!streamHeadGet(arena,pDepacker,&pHead,&size,34))
+		{
+			arena.release(pHead);
+			return NULL;
+		}
+		const ymu32 id = ReadBigEndian32(pHead);
+		if (((id != e_YM5a) && (id != e_YM6a)) ||
+			(strncmp((const char*)(pHead+4),"LeOnArD!",8)) ||
+			(ReadBigEndian32(pHead+16) & A_STREAMINTERLEAVED))
+		{
+			arena.release(pHead);
+			return NULL;
+		}
+		const ymu32 frames = ReadBigEndian32(pHead+12);
+		const ymint drums = (pHead[20]<<8) | pHead[21];
+
+		// skip, drums and the 3 song strings
+		ymu32 need = 34 + ((pHead[32]<<8) | pHead[33]);
+		ymbool bOk = streamHeadGet(arena,pDepacker,&pHead,&size,need);
+		for (ymint i=0;(bOk) && (i<drums);i++)
+		{
+			bOk = streamHeadGet(arena,pDepacker,&pHead,&size,need+4);
+			if (bOk)
+			{
+				ptr = pHead+need;
+				need += 4 + readMotorolaDword(&ptr);
+				bOk = streamHeadGet(arena,pDepacker,&pHead,&size,need);
+			}
+		}
+		for (ymint n=0;(bOk) && (n<3);)
+		{
+			bOk = streamHeadGet(arena,pDepacker,&pHead,&size,need+1);
+			if ((bOk) && (0 == pHead[need++]))
+				n++;
+		}
+
+		if ((!bOk) || ((uint64_t)need + (uint64_t)frames*16 > (uint64_t)fileSize))
+		{
+			arena.release(pHead);
+			return NULL;
+		}
+		*pHeadSize = need;
+		return pHead;
+}
+
+ymu8	*CYmMusic::streamFrame(ymint frame)
+{
+		if (!pStreamDepacker)
+			return pDataStream+frame*streamInc;
+
+		const uint64_t t0 = statsClock();
+		if (frame < streamWindowFrame)
+			streamRewind();
+
+		while (frame >= streamWindowFrame+streamWindowNbFrame)
+		{
+			streamWindowFrame += streamWindowNbFrame;
+			ymint n = nbFrame - streamWindowFrame;
+			if (n > YM_STREAM_WINDOW)
+				n = YM_STREAM_WINDOW;
+			const int size = n*streamInc;
+			const int got = pStreamDepacker->LzRead(pStreamWindow,size);
+			if (got < size)
+			{	// corrupted, play silence rather than garbage
+				memset(pStreamWindow+got,0,size-got);
+				setLastError("LH5 Depacking Error !");
+			}
+			streamWindowNbFrame = n;
+		}
+		if (pStats)
+			pStats->depackNs += statsClock() - t0;
+		return pStreamWindow + (frame-streamWindowFrame)*streamInc;
+}
+
+// going back (loop, seek): depack again from the start, up to the first frame
+void	CYmMusic::streamRewind(void)
+{
+		pStreamDepacker->LzOpen(pStreamSrc,streamSrcSize,fileSize);
+		for (ymu32 skip=streamHeadSize;skip>0;)
+		{
+			const int n = (skip > YM_STREAM_WINDOW*16) ? YM_STREAM_WINDOW*16 : skip;
+			if (pStreamDepacker->LzRead(pStreamWindow,n) != n)
+				break;
+			skip -= n;
+		}
+		streamWindowFrame = 0;
+		streamWindowNbFrame = 0;
+}
+
 static ymint	fileSizeGet(FILE *h)
  {
  ymint size;
@@ -198,59 +583,92 @@ static ymint	fileSizeGet(FILE *h)
  }
 
 
+//---------------------------------------------------
+// pDst[c*rows+r] = pSrc[r*cols+c], e.g. one plane per register (rows)
+// of nbFrame bytes (cols) to one streamInc bytes line per frame.
+// Done a tile of columns at a time rather than striding through
+// every plane for each frame.
+//---------------------------------------------------
+void	CYmMusic::transposeBytes(const ymu8 *pSrc,ymu8 *pDst,ymint rows,ymint cols)
+{
+ymint	c0 = 0;
+ymint	r,c;
+
+#ifdef YM_SSE2
+		if (16 == rows)
+		{	// YM5/YM6: 16x16 blocks in registers
+			for (;c0+16<=cols;c0+=16)
+			{
+				__m128i v[16],t[16];
+				for (r=0;r<16;r++)
+					v[r] = _mm_loadu_si128((const __m128i*)(pSrc + r*cols + c0));
+				// 4 perfect shuffles of the 16 rows do the transpose
+				for (ymint pass=0;pass<4;pass++)
+				{
+					for (r=0;r<8;r++)
+					{
+						t[r*2] = _mm_unpacklo_epi8(v[r],v[r+8]);
+						t[r*2+1] = _mm_unpackhi_epi8(v[r],v[r+8]);
+					}
+					memcpy(v,t,sizeof(v));
+				}
+				for (r=0;r<16;r++)
+					_mm_storeu_si128((__m128i*)(pDst + (c0+r)*16),v[r]);
+			}
+		}
+#endif
+
+		for (;c0<cols;c0+=TRANSPOSE_TILE)
+		{
+			const ymint c1 = (c0+TRANSPOSE_TILE < cols) ? c0+TRANSPOSE_TILE : cols;
+			for (r=0;r<rows;r++)
+			{
+				const ymu8 *pIn = pSrc + r*cols;
+				ymu8 *pOut = pDst + r;
+				for (c=c0;c<c1;c++)
+					pOut[c*rows] = pIn[c];
+			}
+		}
+}
+
 ymbool	CYmMusic::deInterleave(void)
  {
- yms32	nextPlane[32];
- ymu8	*pW,*tmpBuff;
- yms32	j,k;
+ ymu8	*tmpBuff;
 
 
 		if (attrib&A_STREAMINTERLEAVED)
 		{
+			const uint64_t t0 = statsClock();
 
-			tmpBuff = (ymu8*)malloc(nbFrame*streamInc);
+			tmpBuff = (ymu8*)arena.alloc(nbFrame*streamInc);
 			if (!tmpBuff)
 			{
 				setLastError("Malloc error in deInterleave()\n");
 				return YMFALSE;
 			}
 
-			// Precalcul les offsets.
-			for (j=0;j<streamInc;j++) nextPlane[j] = nbFrame*j;
+			transposeBytes(pDataStream,tmpBuff,streamInc,nbFrame);
 
-			pW = tmpBuff;
-			for (j=0;j<nextPlane[1];j++)
+			if (bDrumBorrowed || bBigSampleBufferBorrowed)
+			{	// drums still point into the original
+				arena.release(pStreamMalloc);
+				pStreamMalloc = tmpBuff;
+			}
+			else
 			{
-				for (k=0;k<streamInc;k++)
-				{
-					pW[k] = pDataStream[j + nextPlane[k]];
-				}
-				pW += streamInc;
+				releaseBigMalloc();
+				pBigMalloc = tmpBuff;
 			}
-
-			free(pBigMalloc);
-			pBigMalloc = tmpBuff;
 			pDataStream = tmpBuff;
 
 			attrib &= (~A_STREAMINTERLEAVED);
+			if (pStats)
+				pStats->deInterleaveNs += statsClock() - t0;
 		}
 		return YMTRUE;
  }
 
 
-enum
-{
-	e_YM2a = ('Y' << 24) | ('M' << 16) | ('2' << 8) | ('!'),	//'YM2!'
-	e_YM3a = ('Y' << 24) | ('M' << 16) | ('3' << 8) | ('!'),	//'YM3!'
-	e_YM3b = ('Y' << 24) | ('M' << 16) | ('3' << 8) | ('b'),	//'YM3b'
-	e_YM4a = ('Y' << 24) | ('M' << 16) | ('4' << 8) | ('!'),	//'YM4!'
-	e_YM5a = ('Y' << 24) | ('M' << 16) | ('5' << 8) | ('!'),	//'YM5!'
-	e_YM6a = ('Y' << 24) | ('M' << 16) | ('6' << 8) | ('!'),	//'YM6!'
-	e_MIX1 = ('M' << 24) | ('I' << 16) | ('X' << 8) | ('1'),	//'MIX1'
-	e_YMT1 = ('Y' << 24) | ('M' << 16) | ('T' << 8) | ('1'),	//'YMT1'
-	e_YMT2 = ('Y' << 24) | ('M' << 16) | ('T' << 8) | ('2'),	//'YMT2'
-};
-
 ymbool	CYmMusic::ymDecode(void)
  {
  ymu8 *pUD;
@@ -275,11 +693,11 @@ ymbool	CYmMusic::ymDecode(void)
 				streamInc = 14;
 				nbDrum = 0;
 				setAttrib(A_STREAMINTERLEAVED|A_TIMECONTROL);
-				pSongName = mstrdup("Unknown");
-				pSongAuthor = mstrdup("Unknown");
-				pSongComment = mstrdup("Converted by Leonard.");
-				pSongType = mstrdup("YM 2");
-				pSongPlayer = mstrdup("YM-Chip driver");
+				pSongName = arena.string("Unknown");
+				pSongAuthor = arena.string("Unknown");
+				pSongComment = arena.string("Converted by Leonard.");
+				pSongType = arena.string("YM 2");
+				pSongPlayer = arena.string("YM-Chip driver");
 				break;
 
 			case e_YM3a://'YM3!':		// Standart YM-Atari format.
@@ -292,11 +710,11 @@ ymbool	CYmMusic::ymDecode(void)
 				streamInc = 14;
 				nbDrum = 0;
 				setAttrib(A_STREAMINTERLEAVED|A_TIMECONTROL);
-				pSongName = mstrdup("Unknown");
-				pSongAuthor = mstrdup("Unknown");
-				pSongComment = mstrdup("");
-				pSongType = mstrdup("YM 3");
-				pSongPlayer = mstrdup("YM-Chip driver");
+				pSongName = arena.string("Unknown");
+				pSongAuthor = arena.string("Unknown");
+				pSongComment = arena.string("");
+				pSongType = arena.string("YM 3");
+				pSongPlayer = arena.string("YM-Chip driver");
 				break;
 
 			case e_YM3b://'YM3b':		// Standart YM-Atari format + Loop info.
@@ -310,11 +728,11 @@ ymbool	CYmMusic::ymDecode(void)
 				streamInc = 14;
 				nbDrum = 0;
 				setAttrib(A_STREAMINTERLEAVED|A_TIMECONTROL);
-				pSongName = mstrdup("Unknown");
-				pSongAuthor = mstrdup("Unknown");
-				pSongComment = mstrdup("");
-				pSongType = mstrdup("YM 3b (loop)");
-				pSongPlayer = mstrdup("YM-Chip driver");
+				pSongName = arena.string("Unknown");
+				pSongAuthor = arena.string("Unknown");
+				pSongComment = arena.string("");
+				pSongType = arena.string("YM 3b (loop)");
+				pSongPlayer = arena.string("YM-Chip driver");
 				break;
 
 			case e_YM4a://'YM4!':		// Extended ATARI format.
@@ -340,49 +758,48 @@ ymbool	CYmMusic::ymDecode(void)
 				ptr += skip;
 				if (nbDrum>0)
 				{
-					pDrumTab=(digiDrum_t*)malloc(nbDrum*sizeof(digiDrum_t));
+					pDrumTab=(digiDrum_t*)arena.table(nbDrum*sizeof(digiDrum_t));
+					// 8 bits drums are used as they are in the file, no copy,
+					// 4 bits ones are converted once for all instances
+					bDrumBorrowed = !(attrib&A_DRUM4BITS);
+					bDrumCached = !bDrumBorrowed;
 					for (i=0;i<nbDrum;i++)
 					{
 						pDrumTab[i].size = readMotorolaDword(&ptr);
-						if (pDrumTab[i].size)
+						if (!pDrumTab[i].size)
 						{
-							pDrumTab[i].pData = (ymu8*)malloc(pDrumTab[i].size);
-							memcpy(pDrumTab[i].pData,ptr,pDrumTab[i].size);
-							if (attrib&A_DRUM4BITS)
-							{
-								ymu32 j;
-								ymu8 *pw = pDrumTab[i].pData;
-								for (j=0;j<pDrumTab[i].size;j++)
-								{
-									*pw = ymVolumeTable[(*pw)&15]>>7;
-									pw++;
-								}
-							}
-							ptr += pDrumTab[i].size;
+							pDrumTab[i].pData = NULL;
+						}
+						else if (bDrumBorrowed)
+						{
+							pDrumTab[i].pData = ptr;
 						}
 						else
 						{
-							pDrumTab[i].pData = NULL;
+							pDrumTab[i].pData = drumCacheAcquire(ptr,pDrumTab[i].size);
 						}
+						ptr += pDrumTab[i].size;
+						if (!pDrumTab[i].pData)
+							pDrumTab[i].size = 0;
 					}
 					attrib &= (~A_DRUM4BITS);
 				}
-				pSongName = readNtString((char**)&ptr);
-				pSongAuthor = readNtString((char**)&ptr);
-				pSongComment = readNtString((char**)&ptr);
+				pSongName = readNtString(arena,&ptr);
+				pSongAuthor = readNtString(arena,&ptr);
+				pSongComment = readNtString(arena,&ptr);
 				songType = YM_V5;
 				if (id==e_YM6a)//'YM6!')
 				{
 					songType = YM_V6;
-					pSongType = mstrdup("YM 6");
+					pSongType = arena.string("YM 6");
 				}
 				else
 				{
-					pSongType = mstrdup("YM 5");
+					pSongType = arena.string("YM 5");
 				}
 				pDataStream = ptr;
 				streamInc = 16;
-				pSongPlayer = mstrdup("YM-Chip driver");
+				pSongPlayer = arena.string("YM-Chip driver");
 				break;
 
 			case e_MIX1://'MIX1':		// ATARI Remix digit format.
@@ -399,7 +816,7 @@ ymbool	CYmMusic::ymDecode(void)
 				if (tmp&1) setAttrib(A_DRUMSIGNED);
 				sampleSize = readMotorolaDword(&ptr);
 				nbMixBlock = readMotorolaDword(&ptr);
-				pMixBlock = (mixBlock_t*)malloc(nbMixBlock*sizeof(mixBlock_t));
+				pMixBlock = (mixBlock_t*)arena.table(nbMixBlock*sizeof(mixBlock_t));
 				for (i=0;i<nbMixBlock;i++)
 				{	// Lecture des block-infos.
 					pMixBlock[i].sampleStart = readMotorolaDword(&ptr);
@@ -407,15 +824,19 @@ ymbool	CYmMusic::ymDecode(void)
 					pMixBlock[i].nbRepeat = readMotorolaWord(&ptr);
 					pMixBlock[i].replayFreq = readMotorolaWord(&ptr);
 				}
-				pSongName = readNtString((char**)&ptr);
-				pSongAuthor = readNtString((char**)&ptr);
-				pSongComment = readNtString((char**)&ptr);
-
-				pBigSampleBuffer = (unsigned char*)malloc(sampleSize);
-				memcpy(pBigSampleBuffer,ptr,sampleSize);
-
-				if (!(attrib&A_DRUMSIGNED))
+				pSongName = readNtString(arena,&ptr);
+				pSongAuthor = readNtString(arena,&ptr);
+				pSongComment = readNtString(arena,&ptr);
+
+				if (attrib&A_DRUMSIGNED)
+				{	// used as it is in the file, no copy
+					pBigSampleBuffer = ptr;
+					bBigSampleBufferBorrowed = YMTRUE;
+				}
+				else
 				{
+					pBigSampleBuffer = (unsigned char*)arena.alloc(sampleSize);
+					memcpy(pBigSampleBuffer,ptr,sampleSize);
 					signeSample(pBigSampleBuffer,sampleSize);
 					setAttrib(A_DRUMSIGNED);
 				}
@@ -426,8 +847,8 @@ ymbool	CYmMusic::ymDecode(void)
 				mixPos = -1;		// numero du block info.
 				currentPente = 0;
 				currentPos = 0;
-				pSongType = mstrdup("MIX1");
-				pSongPlayer = mstrdup("Digi-Mix driver");
+				pSongType = arena.string("MIX1");
+				pSongPlayer = arena.string("Digi-Mix driver");
 
 				break;
 
@@ -462,12 +883,14 @@ ymbool	CYmMusic::ymDecode(void)
 				loopFrame = readMotorolaDword(&ptr);
 				nbDrum = readMotorolaWord(&ptr);
 				attrib = readMotorolaDword(&ptr);
-				pSongName = readNtString((char**)&ptr);
-				pSongAuthor = readNtString((char**)&ptr);
-				pSongComment = readNtString((char**)&ptr);
+				pSongName = readNtString(arena,&ptr);
+				pSongAuthor = readNtString(arena,&ptr);
+				pSongComment = readNtString(arena,&ptr);
 				if (nbDrum>0)
 				{
-					pDrumTab=(digiDrum_t*)malloc(nbDrum*sizeof(digiDrum_t));
+					pDrumTab=(digiDrum_t*)arena.table(nbDrum*sizeof(digiDrum_t));
+					// the mixer only reads them, no copy
+					bDrumBorrowed = YMTRUE;
 					for (i=0;i<(ymint)nbDrum;i++)
 					{
 						pDrumTab[i].size = readMotorolaWord(&ptr);
@@ -482,16 +905,8 @@ ymbool	CYmMusic::ymDecode(void)
 							pDrumTab[i].repLen = pDrumTab[i].size;
 						}
 
-						if (pDrumTab[i].size)
-						{
-							pDrumTab[i].pData = (ymu8*)malloc(pDrumTab[i].size);
-							memcpy(pDrumTab[i].pData,ptr,pDrumTab[i].size);
-							ptr += pDrumTab[i].size;
-						}
-						else
-						{
-							pDrumTab[i].pData = NULL;
-						}
+						pDrumTab[i].pData = (pDrumTab[i].size) ? ptr : NULL;
+						ptr += pDrumTab[i].size;
 					}
 				}
 
@@ -500,21 +915,22 @@ ymbool	CYmMusic::ymDecode(void)
 				{
 					ymTrackerFreqShift = (attrib>>28)&15;
 					attrib &= 0x0fffffff;
-					pSongType = mstrdup("YM-T2");
+					pSongType = arena.string("YM-T2");
 				}
 				else
 				{
-					pSongType = mstrdup("YM-T1");
+					pSongType = arena.string("YM-T1");
 				}
 
 
 				pDataStream = ptr;
 				ymChip.setClock(ATARI_CLOCK);
 
-				ymTrackerInit(100);		// 80% de volume maxi.
+				if (!ymTrackerInit(100))		// 80% de volume maxi.
+					return YMFALSE;
 				streamInc = 16;
 				setTimeControl(YMTRUE);
-				pSongPlayer = mstrdup("Universal Tracker");
+				pSongPlayer = arena.string("Universal Tracker");
 				break;
 
 			default:
@@ -558,6 +974,103 @@ ymbool	CYmMusic::checkCompilerTypes()
 }
 
 
+// free, unmap or just forget a block of file data, whichever it is
+static void	releaseFileBlock(CYmArena &arena,ymu8 **ppData,ymbool *pbBorrowed,ymu32 *pMapSize)
+{
+#ifdef YM_MMAP
+		if (*pMapSize)
+			munmap(*ppData,*pMapSize);
+		else
+#endif
+		if (!*pbBorrowed)
+			arena.release(*ppData);
+
+		*ppData = NULL;
+		*pbBorrowed = YMFALSE;
+		*pMapSize = 0;
+}
+
+void	CYmMusic::releaseBigMalloc(void)
+{
+		releaseFileBlock(arena,&pBigMalloc,&bBigMallocBorrowed,&bigMallocMapSize);
+}
+
+void	CYmMusic::streamClose(void)
+{
+		if (pStreamDepacker)
+		{
+			delete pSpareDepacker;
+			pSpareDepacker = pStreamDepacker;
+			pStreamDepacker = NULL;
+		}
+		arena.release(pStreamWindow);
+		pStreamWindow = NULL;
+		releaseFileBlock(arena,&pStreamFile,&bStreamFileBorrowed,&streamFileMapSize);
+}
+
+ymbool	CYmMusic::mapFile(const char *fileName)
+{
+#ifdef YM_MMAP
+		const int fd = open(fileName,O_RDONLY);
+		if (fd<0)
+			return YMFALSE;
+
+		struct stat st;
+		void *pMap = MAP_FAILED;
+		if ((fstat(fd,&st)==0) && S_ISREG(st.st_mode) && (st.st_size>0) && (st.st_size<=0x7fffffff))
+		{
+			// private: whatever gets written to it never reaches the file
+			pMap = mmap(NULL,st.st_size,PROT_READ|PROT_WRITE,MAP_PRIVATE,fd,0);
+		}
+		close(fd);
+		if (MAP_FAILED == pMap)
+			return YMFALSE;
+
+		fileSize = (ymint)st.st_size;
+		pBigMalloc = (ymu8*)pMap;
+		bBigMallocBorrowed = YMTRUE;
+		bigMallocMapSize = (ymu32)st.st_size;
+		return YMTRUE;
+#else
+		return YMFALSE;
+#endif
+}
+
+ymbool	CYmMusic::loadBigMalloc(void)
+{
+		//---------------------------------------------------
+		// Transforme les donnes en donnes valides.
+		//---------------------------------------------------
+		uint64_t t0 = statsClock();
+		pBigMalloc = depackFile(fileSize);
+		if (pStats)
+			pStats->depackNs += statsClock() - t0;
+		if (!pBigMalloc)
+		{
+			return YMFALSE;
+		}
+
+		//---------------------------------------------------
+		// Lecture des donnes YM:
+		//---------------------------------------------------
+		t0 = statsClock();
+		const uint64_t deInterleaveNs = (pStats) ? pStats->deInterleaveNs : 0;
+		const ymbool bDecoded = ymDecode();
+		if (pStats)
+			pStats->decodeNs += statsClock() - t0 - (pStats->deInterleaveNs - deInterleaveNs);
+		if (!bDecoded)
+		{
+			releaseBigMalloc();
+			streamClose();
+			return YMFALSE;
+		}
+
+		ymChip.reset();
+		bMusicOk = YMTRUE;
+		bPause = YMFALSE;
+		return YMTRUE;
+}
+
 ymbool	CYmMusic::load(const char *fileName)
 {
 FILE	*in;
@@ -569,6 +1082,17 @@ FILE	*in;
 		if (!checkCompilerTypes())
 			return YMFALSE;
 
+		//---------------------------------------------------
+		// Map the file if we can, no need for a copy of it.
+		//---------------------------------------------------
+		const uint64_t t0 = statsClock();
+		if (mapFile(fileName))
+		{
+			if (pStats)
+				pStats->readNs += statsClock() - t0;
+			return loadBigMalloc();
+		}
+
 		in = fopen(fileName,"rb");
 		if (!in)
 		{
@@ -580,7 +1104,7 @@ FILE	*in;
 		// Allocation d'un buffer pour lire le fichier.
 		//---------------------------------------------------
 		fileSize = fileSizeGet(in);
-		pBigMalloc = (unsigned char*)malloc(fileSize);
+		pBigMalloc = (unsigned char*)arena.alloc(fileSize);
 		if (!pBigMalloc)
 		{
 			setLastError("MALLOC Error");
@@ -593,36 +1117,16 @@ FILE	*in;
 		//---------------------------------------------------
 		if (fread(pBigMalloc,1,fileSize,in)!=(size_t)fileSize)
 		{
-			free(pBigMalloc);
+			releaseBigMalloc();
 			setLastError("File is corrupted.");
 			fclose(in);
 			return YMFALSE;
 		}
 		fclose(in);
+		if (pStats)
+			pStats->readNs += statsClock() - t0;
 
-		//---------------------------------------------------
-		// Transforme les donnes en donnes valides.
-		//---------------------------------------------------
-		pBigMalloc = depackFile(fileSize);
-		if (!pBigMalloc)
-		{
-			return YMFALSE;
-		}
-
-		//---------------------------------------------------
-		// Lecture des donnes YM:
-		//---------------------------------------------------
-		if (!ymDecode())
-		{
-			free(pBigMalloc);
-			pBigMalloc = NULL;
-			return YMFALSE;
-		}
-
-		ymChip.reset();
-		bMusicOk = YMTRUE;
-		bPause = YMFALSE;
-		return YMTRUE;
+		return loadBigMalloc();
  }
 
 ymbool	CYmMusic::loadMemory(void *pBlock,ymu32 size)
@@ -638,8 +1142,9 @@ ymbool	CYmMusic::loadMemory(void *pBlock,ymu32 size)
 		//---------------------------------------------------
 		// Allocation d'un buffer pour lire le fichier.
 		//---------------------------------------------------
+		const uint64_t t0 = statsClock();
 		fileSize = size;
-		pBigMalloc = (unsigned char*)malloc(fileSize);
+		pBigMalloc = (unsigned char*)arena.alloc(fileSize);
 		if (!pBigMalloc)
 		{
 			setLastError("MALLOC Error");
@@ -650,64 +1155,80 @@ ymbool	CYmMusic::loadMemory(void *pBlock,ymu32 size)
 		// Chargement du fichier complet.
 		//---------------------------------------------------
 		memcpy(pBigMalloc,pBlock,size);
+		if (pStats)
+			pStats->readNs += statsClock() - t0;
 
-		//---------------------------------------------------
-		// Transforme les donnes en donnes valides.
-		//---------------------------------------------------
-		pBigMalloc = depackFile(size);
-		if (!pBigMalloc)
-		{
+		return loadBigMalloc();
+ }
+
+ymbool	CYmMusic::loadMemoryNoCopy(void *pBlock,ymu32 size)
+{
+
+
+		stop();
+		unLoad();
+
+		if (!checkCompilerTypes())
 			return YMFALSE;
-		}
 
 		//---------------------------------------------------
-		// Lecture des donnes YM:
+		// Use the caller block as it is, it is never written to.
 		//---------------------------------------------------
-		if (!ymDecode())
-		{
-			free(pBigMalloc);
-			pBigMalloc = NULL;
-			return YMFALSE;
-		}
+		fileSize = size;
+		pBigMalloc = (ymu8*)pBlock;
+		bBigMallocBorrowed = YMTRUE;
 
-		ymChip.reset();
-		bMusicOk = YMTRUE;
-		bPause = YMFALSE;
-		return YMTRUE;
+		return loadBigMalloc();
  }
 
-void	myFree(void **pPtr)
-{
-		if (*pPtr) free(*pPtr);
-		*pPtr = NULL;
-}
-
 void	CYmMusic::unLoad(void)
 {
 
 		bMusicOk = YMFALSE;
 		bPause = YMTRUE;
 		bMusicOver = YMFALSE;
-		myFree((void**)&pSongName);
-		myFree((void**)&pSongAuthor);
-		myFree((void**)&pSongComment);
-		myFree((void**)&pSongType);
-		myFree((void**)&pSongPlayer);
-		myFree((void**)&pBigMalloc);
-		if (nbDrum>0)
+		pSongName = NULL;
+		pSongAuthor = NULL;
+		pSongComment = NULL;
+		pSongType = NULL;
+		pSongPlayer = NULL;
+		if ((nbDrum>0) && (bDrumCached))
 		{
 			for (ymint i=0;i<nbDrum;i++)
 			{
-				myFree((void**)&pDrumTab[i].pData);
+				if (pDrumTab[i].pData)
+					drumCacheRelease(pDrumTab[i].pData,pDrumTab[i].size);
 			}
-			nbDrum = 0;
-			myFree((void**)&pDrumTab);
 		}
-		myFree((void**)&pBigSampleBuffer);
-		myFree((void**)&pMixBlock);
-
-		myFree((void**)&m_pTimeInfo);
+		nbDrum = 0;
+		pDrumTab = NULL;
+		bDrumBorrowed = YMFALSE;
+		bDrumCached = YMFALSE;
+		if (!bBigSampleBufferBorrowed)
+			arena.release(pBigSampleBuffer);
+		pBigSampleBuffer = NULL;
+		bBigSampleBufferBorrowed = YMFALSE;
+		arena.release(pStreamMalloc);
+		pStreamMalloc = NULL;
+		releaseBigMalloc();
+		streamClose();
+		pMixBlock = NULL;
+
+		m_pTimeInfo = NULL;
+
+		// names, drum and MIX1 tables
+		arena.reset();
+}
 
+void	CYmMusic::trim(void)
+{
+		stop();
+		unLoad();
+		arena.purge();
+		delete pSpareDepacker;
+		pSpareDepacker = NULL;
+		free(pTracker);
+		pTracker = NULL;
 }
 
 void	CYmMusic::stop(void)
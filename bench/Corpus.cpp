@@ -0,0 +1,326 @@
+/*
+ * convertym benchmarks
+ * Copyright (C) 2024 Pat Deegan, https://psychogenic.com
+ *
+ * Built in benchmark corpus, see Corpus.h.  The file layouts are the
+ * ones ymDecode() reads, in Ymload.cpp.
+ */
+
+#include "Corpus.h"
+#include "Lh5Pack.h"
+#include <string.h>
+
+#define CORPUS_SEED     0x594d3521      // "YM5!"
+#define CORPUS_CLOCK    2000000
+#define CORPUS_RATE     50
+
+// YM5/YM6 attributes
+#define YM_ATTR_INTERLEAVED     1
+#define YM_ATTR_DRUM4BITS       4
+
+// YM6 effect codes, top nibble of r1 (first effect) or r3 (second one)
+#define YM6_FX_SID              0x00
+#define YM6_FX_DRUM             0x40
+#define YM6_FX_SINUS_SID        0x80
+#define YM6_FX_BUZZER           0xc0
+
+typedef enum {
+    EffectsNone = 0,
+    EffectsYM5,
+    EffectsYM6
+} Effects;
+
+namespace {
+
+// the same sequence on every platform, unlike rand()
+class Random
+{
+public:
+        Random(uint32_t seed) : m_state(seed) {}
+        int below(int n) {
+                m_state = m_state * 1664525u + 1013904223u;
+                return (m_state >> 8) % n;
+        }
+
+private:
+        uint32_t m_state;
+};
+
+typedef std::vector<uint8_t> Bytes;
+typedef std::vector<Bytes> Frames;      // 16 registers a frame
+
+static void putBigEndian(Bytes & out, uint32_t value, int numBytes) {
+        for (int i=numBytes-1; i>=0; i--) {
+                out.push_back((uint8_t)(value >> (8*i)));
+        }
+}
+
+static void putString(Bytes & out, const char * str) {
+        out.insert(out.end(), str, str + strlen(str) + 1);
+}
+
+static void putBytes(Bytes & out, const Bytes & bytes) {
+        out.insert(out.end(), bytes.begin(), bytes.end());
+}
+
+/*
+ * Something like a tune: a bass line on A, a slower melody on B, an
+ * arpeggio on C, noise and envelope now and then, a silent stretch in
+ * the middle (runs of unchanged frames).
+ */
+static Frames makeFrames(Random & rnd, int nbFrame, Effects effects) {
+        static const uint16_t periods[12] = {3822, 3608, 3405, 3214, 3034, 2863, 2703, 2551, 2408, 2273, 2145, 2025};
+        static const uint8_t mixers[4] = {0x38, 0x3e, 0x36, 0x30};
+        Frames frames;
+        Bytes reg(16, 0);
+        int noteA = 0, noteB = 0;
+        for (int f=0; f<nbFrame; f++) {
+                if (f % 6 == 0) {
+                        noteA = rnd.below(12);
+                        int period = periods[noteA] >> (2 + rnd.below(2));
+                        reg[0] = period & 0xff;
+                        reg[1] = period >> 8;
+                        reg[8] = 15;
+                } else if (reg[8] > 8) {
+                        reg[8]--;
+                }
+                if (f % 12 == 0) {
+                        noteB = rnd.below(12);
+                        int period = periods[noteB] >> (3 + rnd.below(2));
+                        reg[2] = period & 0xff;
+                        reg[3] = period >> 8;
+                        reg[9] = 12 + rnd.below(4);
+                }
+                int period = periods[(noteA + 4 * (f % 3)) % 12] >> 4;
+                reg[4] = period & 0xff;
+                reg[5] = period >> 8;
+                reg[10] = (f % 48 < 24) ? 0x10 : 10;    // envelope half of the time
+                if (f % 24 == 0) {
+                        reg[6] = rnd.below(32);
+                        reg[7] = mixers[rnd.below(4)];
+                }
+                reg[11] = 0x40 + (f & 0x3f);
+                reg[12] = 0;
+                Bytes frame(reg);
+                frame[13] = (f % 48 == 0) ? 8 + 2 * rnd.below(4) : 0xff;
+
+                if (effects == EffectsYM5) {
+                        if (f % 20 == 0) {              // SID on A
+                                frame[1] |= 0x10;
+                                frame[6] |= 3 << 5;
+                                frame[14] = 50 + rnd.below(50);
+                        }
+                        if (f % 30 == 5) {              // drum 1 or 2 on B
+                                frame[3] |= 0x20;
+                                frame[9] = rnd.below(2);
+                                frame[8] |= 2 << 5;
+                                frame[15] = 40;
+                        }
+                } else if (effects == EffectsYM6) {
+                        static const uint8_t first[3] = {YM6_FX_SID, YM6_FX_SINUS_SID, YM6_FX_BUZZER};
+                        if (f % 16 == 0) {              // A or C
+                                int voice = rnd.below(2) * 2;
+                                frame[1] |= first[(f / 16) % 3] | ((voice + 1) << 4);
+                                frame[6] |= (1 + rnd.below(3)) << 5;
+                                frame[14] = 20 + rnd.below(100);
+                        }
+                        if (f % 30 == 5) {              // drum on B
+                                frame[3] |= YM6_FX_DRUM | (2 << 4);
+                                frame[9] = rnd.below(2);
+                                frame[8] |= 2 << 5;
+                                frame[15] = 40;
+                        }
+                }
+
+                if (f > nbFrame / 2 && f < nbFrame / 2 + 50) {
+                        frame.assign(16, 0);
+                        frame[7] = 0xff;
+                        frame[13] = 0xff;
+                }
+                frames.push_back(frame);
+        }
+        return frames;
+}
+
+// numRegs planes of one byte per frame, the YM2 to YM6 interleaved layout
+static Bytes interleave(const Frames & frames, int numRegs) {
+        Bytes out;
+        for (int r=0; r<numRegs; r++) {
+                for (const Bytes & frame : frames) {
+                        out.push_back(frame[r]);
+                }
+        }
+        return out;
+}
+
+static Bytes makeYm3(Random & rnd, int nbFrame, bool loop, bool madmax) {
+        Frames frames = makeFrames(rnd, nbFrame, EffectsNone);
+        if (madmax) {
+                // YM2: a MADMAX drum (r10 bit 7, sample in the low bits, r12 its rate)
+                for (int f=0; f<nbFrame; f+=25) {
+                        frames[f][10] = 0x80 | rnd.below(40);
+                        frames[f][12] = 100;
+                }
+        }
+        Bytes out;
+        const char * id = madmax ? "YM2!" : loop ? "YM3b" : "YM3!";
+        out.insert(out.end(), id, id + 4);
+        putBytes(out, interleave(frames, 14));
+        if (loop) {
+                // the only little endian field in a YM file
+                uint32_t loopFrame = nbFrame / 4;
+                for (int i=0; i<4; i++) {
+                        out.push_back((uint8_t)(loopFrame >> (8*i)));
+                }
+        }
+        return out;
+}
+
+static Bytes makeYm5(Random & rnd, const char * id, int nbFrame, Effects effects,
+                bool interleaved, bool drum4) {
+        Frames frames = makeFrames(rnd, nbFrame, effects);
+        Bytes drums[2];
+        for (int i=0; i<300; i++) {
+                drums[0].push_back(rnd.below(drum4 ? 16 : 256));
+        }
+        for (int i=0; i<512; i++) {
+                int v = (i & 63) < 32 ? (i & 31) * 8 : (63 - (i & 63)) * 8;
+                drums[1].push_back(drum4 ? v >> 4 : v);
+        }
+
+        Bytes out;
+        out.insert(out.end(), id, id + 4);
+        putString(out, "LeOnArD!");
+        out.pop_back();
+        putBigEndian(out, nbFrame, 4);
+        putBigEndian(out, (interleaved ? YM_ATTR_INTERLEAVED : 0) | (drum4 ? YM_ATTR_DRUM4BITS : 0), 4);
+        putBigEndian(out, 2, 2);                // drums
+        putBigEndian(out, CORPUS_CLOCK, 4);
+        putBigEndian(out, CORPUS_RATE, 2);
+        putBigEndian(out, nbFrame / 3, 4);      // loop frame
+        putBigEndian(out, 0, 2);                // extra data
+        for (const Bytes & drum : drums) {
+                putBigEndian(out, drum.size(), 4);
+                putBytes(out, drum);
+        }
+        putString(out, "Benchmark");
+        putString(out, "convertym");
+        putString(out, "synthetic");
+        if (interleaved) {
+                putBytes(out, interleave(frames, 16));
+        } else {
+                for (const Bytes & frame : frames) {
+                        putBytes(out, frame);
+                }
+        }
+        out.insert(out.end(), "End!", "End!" + 4);
+        return out;
+}
+
+// digitized sample blocks, played with repeats at different rates
+static Bytes makeMix1(Random & rnd) {
+        Bytes sample;
+        for (int i=0; i<40000; i++) {
+                int phase = i % 64;
+                int v = phase < 32 ? phase * 8 : (63 - phase) * 8;
+                sample.push_back((uint8_t)(v + rnd.below(16) - 8));
+        }
+        Bytes out;
+        out.insert(out.end(), "MIX1", "MIX1" + 4);
+        putString(out, "LeOnArD!");
+        out.pop_back();
+        putBigEndian(out, 1, 4);                // signed samples
+        putBigEndian(out, sample.size(), 4);
+        static const uint32_t blocks[4][4] = {
+                {0, 10000, 4, 12000}, {10000, 16000, 2, 8000},
+                {26000, 14000, 3, 20000}, {0, 40000, 1, 11025}};
+        putBigEndian(out, 4, 4);
+        for (int b=0; b<4; b++) {
+                putBigEndian(out, blocks[b][0], 4);
+                putBigEndian(out, blocks[b][1], 4);
+                putBigEndian(out, blocks[b][2], 2);
+                putBigEndian(out, blocks[b][3], 2);
+        }
+        putString(out, "Benchmark mix");
+        putString(out, "convertym");
+        putString(out, "synthetic");
+        putBytes(out, sample);
+        return out;
+}
+
+// universal tracker: 4 voices of note on, volume and frequency lines
+static Bytes makeYmt1(Random & rnd) {
+        const int nbVoice = 4;
+        const int nbFrame = 3000;
+        Bytes out;
+        out.insert(out.end(), "YMT1", "YMT1" + 4);
+        putString(out, "LeOnArD!");
+        out.pop_back();
+        putBigEndian(out, nbVoice, 2);
+        putBigEndian(out, CORPUS_RATE, 2);
+        putBigEndian(out, nbFrame, 4);
+        putBigEndian(out, 0, 4);                // loop frame
+        putBigEndian(out, 3, 2);                // samples
+        putBigEndian(out, YM_ATTR_INTERLEAVED, 4);
+        putString(out, "Benchmark tracker");
+        putString(out, "convertym");
+        putString(out, "synthetic");
+        for (int s=0; s<3; s++) {
+                int size = 800 + 400 * s;
+                putBigEndian(out, size, 2);
+                for (int i=0; i<size; i++) {
+                        out.push_back((uint8_t)((i * (3 + s)) + rnd.below(8)));
+                }
+        }
+        Bytes lines;
+        for (int f=0; f<nbFrame; f++) {
+                for (int v=0; v<nbVoice; v++) {
+                        bool on = (f % (8 + 2 * v)) == 0;
+                        lines.push_back(on ? rnd.below(3) : 0xff);
+                        lines.push_back(30 + 8 * v);
+                        int freq = 2000 + rnd.below(6000);
+                        lines.push_back(freq >> 8);
+                        lines.push_back(freq & 0xff);
+                }
+        }
+        // interleaved: one plane per byte of a frame line
+        const int step = 4 * nbVoice;
+        for (int k=0; k<step; k++) {
+                for (int f=0; f<nbFrame; f++) {
+                        out.push_back(lines[f * step + k]);
+                }
+        }
+        return out;
+}
+
+static CorpusSong song(const char * name, const Bytes & data) {
+        CorpusSong s;
+        s.name = name;
+        s.data = data;
+        return s;
+}
+
+} // namespace
+
+
+std::vector<CorpusSong> makeCorpus() {
+        Random rnd(CORPUS_SEED);
+        std::vector<CorpusSong> corpus;
+        corpus.push_back(song("ym2-madmax.ym", makeYm3(rnd, 1500, false, true)));
+        corpus.push_back(song("ym3.ym", makeYm3(rnd, 3000, false, false)));
+        corpus.push_back(song("ym3b-loop.ym", makeYm3(rnd, 2000, true, false)));
+        corpus.push_back(song("ym5-effects.ym", makeYm5(rnd, "YM5!", 4000, EffectsYM5, true, false)));
+        corpus.push_back(song("ym5-drum4.ym", makeYm5(rnd, "YM5!", 2500, EffectsYM5, false, true)));
+        corpus.push_back(song("ym6-effects.ym", makeYm5(rnd, "YM6!", 4000, EffectsYM6, true, false)));
+        corpus.push_back(song("mix1.ym", makeMix1(rnd)));
+        corpus.push_back(song("ymt1.ym", makeYmt1(rnd)));
+        // packed like the real ones: whole file depacked at load, or
+        // streamed (non interleaved YM5/YM6) as the player gets there
+        corpus.push_back(song("ym3-lh5.ym", lh5Pack(corpus[1].data, "ym3.ym")));
+        corpus.push_back(song("ym5-effects-lh5.ym", lh5Pack(corpus[3].data, "ym5-effects.ym")));
+        corpus.push_back(song("ym6-stream-lh5.ym",
+                        lh5Pack(makeYm5(rnd, "YM6!", 6000, EffectsYM6, false, false), "ym6-stream.ym")));
+        corpus.push_back(song("ym5-long-lh5.ym",
+                        lh5Pack(makeYm5(rnd, "YM5!", 30000, EffectsNone, true, false), "ym5-long.ym")));
+        return corpus;
+}
@@ -0,0 +1,27 @@
+/*
+ * convertym benchmarks
+ * Copyright (C) 2024 Pat Deegan, https://psychogenic.com
+ *
+ * The built in benchmark corpus: one or more songs of each kind the
+ * library reads (YM2, YM3, YM3b, YM5, YM6, MIX1, YM-T1), plain and
+ * LH5 packed, made up from a fixed seed so every build gets the very
+ * same bytes.  Their content is synthetic but exercises the same
+ * paths real songs do: envelopes, noise, SID, sinus SID, digidrums,
+ * buzzer, MADMAX drums, streamed depacking, loops.
+ */
+
+#ifndef __CORPUS__
+#define __CORPUS__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+typedef struct {
+    std::string name;
+    std::vector<uint8_t> data;
+} CorpusSong;
+
+std::vector<CorpusSong> makeCorpus();
+
+#endif
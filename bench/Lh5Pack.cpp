@@ -0,0 +1,371 @@
+/*
+ * convertym benchmarks
+ * Copyright (C) 2024 Pat Deegan, https://psychogenic.com
+ *
+ * -lh5- packer, see Lh5Pack.h.  The format is the one LZH/LzhLib.cpp
+ * depacks: blocks of a 16 bits token count, then the code lengths of
+ * the literal/length (C), through their own (T) code, and distance (P)
+ * trees, then the tokens.
+ */
+
+#include "Lh5Pack.h"
+#include <string.h>
+#include <queue>
+#include <algorithm>
+
+#define LH5_NC          510     // 256 literals and match lengths 3 to 256
+#define LH5_NT          19
+#define LH5_NP          14
+#define LH5_CBIT        9
+#define LH5_TBIT        5
+#define LH5_PBIT        4
+#define LH5_DICSIZ      8192
+#define LH5_MAXMATCH    256
+#define LH5_THRESHOLD   3
+#define LH5_MAXCODE     16      // longest code the depacker tables take
+
+// how many earlier positions with the same hash a match is looked for at
+#define LH5_CHAIN       16
+
+namespace {
+
+class BitWriter
+{
+public:
+        BitWriter() : m_acc(0), m_bits(0) {}
+
+        // the numBits low bits of value, most significant first
+        void put(uint32_t value, int numBits) {
+                for (int i=numBits-1; i>=0; i--) {
+                        m_acc = (m_acc << 1) | ((value >> i) & 1);
+                        if (++m_bits == 8) {
+                                out.push_back(m_acc);
+                                m_acc = 0;
+                                m_bits = 0;
+                        }
+                }
+        }
+        void finish() {
+                while (m_bits) {
+                        put(0, 1);
+                }
+        }
+
+        std::vector<uint8_t> out;
+
+private:
+        uint8_t m_acc;
+        int m_bits;
+};
+
+// literal (code < 256) or match (code 256 + length - 3, dist 0 based)
+typedef struct {
+    uint16_t code;
+    uint16_t dist;
+} Token;
+
+static int bitLength(uint32_t value) {
+        int n = 0;
+        while (value) {
+                n++;
+                value >>= 1;
+        }
+        return n;
+}
+
+/*
+ * Huffman code lengths for freq, all 0 with less than two symbols used
+ * (those are written as the single symbol instead).  Too long codes
+ * get the frequencies halved until they fit.
+ */
+static std::vector<uint8_t> huffmanLengths(std::vector<uint32_t> freq) {
+        const int n = freq.size();
+        std::vector<uint8_t> lens(n);
+        typedef std::pair<uint64_t, int> Node;
+        for (;;) {
+                std::priority_queue<Node, std::vector<Node>, std::greater<Node> > heap;
+                std::vector<int> parent(n, -1);
+                for (int i=0; i<n; i++) {
+                        if (freq[i]) {
+                                heap.push(Node(freq[i], i));
+                        }
+                }
+                std::fill(lens.begin(), lens.end(), 0);
+                if (heap.size() < 2) {
+                        return lens;
+                }
+                while (heap.size() > 1) {
+                        Node a = heap.top();
+                        heap.pop();
+                        Node b = heap.top();
+                        heap.pop();
+                        parent[a.second] = parent.size();
+                        parent[b.second] = parent.size();
+                        heap.push(Node(a.first + b.first, parent.size()));
+                        parent.push_back(-1);
+                }
+                int longest = 0;
+                for (int i=0; i<n; i++) {
+                        if (freq[i]) {
+                                int depth = 0;
+                                for (int p=i; parent[p] >= 0; p = parent[p]) {
+                                        depth++;
+                                }
+                                lens[i] = depth;
+                                longest = std::max(longest, depth);
+                        }
+                }
+                if (longest <= LH5_MAXCODE) {
+                        return lens;
+                }
+                for (uint32_t & f : freq) {
+                        f = (f + 1) / 2;
+                }
+        }
+}
+
+// codes in the order the depacker's make_table() expects: by length, then symbol
+static std::vector<uint16_t> canonicalCodes(const std::vector<uint8_t> & lens) {
+        std::vector<uint16_t> codes(lens.size());
+        uint32_t next = 0;
+        for (int len=1; len<=LH5_MAXCODE; len++) {
+                for (std::size_t i=0; i<lens.size(); i++) {
+                        if (lens[i] == len) {
+                                codes[i] = next++;
+                        }
+                }
+                next <<= 1;
+        }
+        return codes;
+}
+
+// a T or P tree of a single symbol: count 0, then the symbol
+static void writeSingle(BitWriter & bw, int symbol, int numBits) {
+        bw.put(0, numBits);
+        bw.put(symbol, numBits);
+}
+
+// T or P code lengths, as read_pt_len() reads them
+static void writeLengths(BitWriter & bw, const std::vector<uint8_t> & lens, int numBits, int special) {
+        int n = lens.size();
+        while (n && ! lens[n-1]) {
+                n--;
+        }
+        bw.put(n, numBits);
+        for (int i=0; i<n; ) {
+                int len = lens[i++];
+                if (len < 7) {
+                        bw.put(len, 3);
+                } else {
+                        bw.put(7, 3);
+                        bw.put((1 << (len - 7)) - 1, len - 7);
+                        bw.put(0, 1);
+                }
+                if (i == special) {
+                        // up to 3 zero lengths skipped
+                        int zeros = 0;
+                        while (zeros < 3 && i + zeros < n && ! lens[i + zeros]) {
+                                zeros++;
+                        }
+                        bw.put(zeros, 2);
+                        i += zeros;
+                }
+        }
+}
+
+static int usedSymbols(const std::vector<uint32_t> & freq, int * last) {
+        int used = 0;
+        for (std::size_t i=0; i<freq.size(); i++) {
+                if (freq[i]) {
+                        used++;
+                        *last = i;
+                }
+        }
+        return used;
+}
+
+static void encodeBlock(BitWriter & bw, const Token * tokens, int count) {
+        std::vector<uint32_t> cFreq(LH5_NC), pFreq(LH5_NP);
+        for (int i=0; i<count; i++) {
+                cFreq[tokens[i].code]++;
+                if (tokens[i].code >= 256) {
+                        pFreq[bitLength(tokens[i].dist)]++;
+                }
+        }
+        std::vector<uint8_t> cLen = huffmanLengths(cFreq);
+        std::vector<uint8_t> pLen = huffmanLengths(pFreq);
+        bw.put(count, 16);
+
+        int cSymbol = 0;
+        if (usedSymbols(cFreq, &cSymbol) == 1) {
+                writeSingle(bw, 0, LH5_TBIT);
+                writeSingle(bw, cSymbol, LH5_CBIT);
+        } else {
+                // C lengths through the T code: 0 to 2 are zero runs, others length + 2
+                int n = LH5_NC;
+                while (n && ! cLen[n-1]) {
+                        n--;
+                }
+                std::vector<Token> runs;        // code: T symbol, dist: extra bits (width implied)
+                for (int i=0; i<n; ) {
+                        if (cLen[i]) {
+                                runs.push_back(Token{(uint16_t)(cLen[i++] + 2), 0});
+                                continue;
+                        }
+                        int run = 0;
+                        while (i + run < n && ! cLen[i + run]) {
+                                run++;
+                        }
+                        i += run;
+                        while (run > 0) {
+                                if (run <= 2) {
+                                        runs.push_back(Token{0, 0});
+                                        run--;
+                                } else if (run <= 18) {
+                                        runs.push_back(Token{1, (uint16_t)(run - 3)});
+                                        run = 0;
+                                } else if (run == 19) {
+                                        runs.push_back(Token{0, 0});
+                                        runs.push_back(Token{1, 15});
+                                        run = 0;
+                                } else {
+                                        int len = std::min(run, 531);
+                                        runs.push_back(Token{2, (uint16_t)(len - 20)});
+                                        run -= len;
+                                }
+                        }
+                }
+                std::vector<uint32_t> tFreq(LH5_NT);
+                for (const Token & t : runs) {
+                        tFreq[t.code]++;
+                }
+                std::vector<uint8_t> tLen = huffmanLengths(tFreq);
+                int tSymbol = 0;
+                if (usedSymbols(tFreq, &tSymbol) == 1) {
+                        writeSingle(bw, tSymbol, LH5_TBIT);
+                } else {
+                        writeLengths(bw, tLen, LH5_TBIT, 3);
+                }
+                std::vector<uint16_t> tCodes = canonicalCodes(tLen);
+                bw.put(n, LH5_CBIT);
+                for (const Token & t : runs) {
+                        bw.put(tCodes[t.code], tLen[t.code]);
+                        if (t.code == 1) {
+                                bw.put(t.dist, 4);
+                        } else if (t.code == 2) {
+                                bw.put(t.dist, LH5_CBIT);
+                        }
+                }
+        }
+
+        int pSymbol = 0;
+        if (usedSymbols(pFreq, &pSymbol) < 2) {
+                writeSingle(bw, pSymbol, LH5_PBIT);
+        } else {
+                writeLengths(bw, pLen, LH5_PBIT, -1);
+        }
+
+        // a single symbol tree has no code at all, lengths are all 0 then
+        std::vector<uint16_t> cCodes = canonicalCodes(cLen);
+        std::vector<uint16_t> pCodes = canonicalCodes(pLen);
+        for (int i=0; i<count; i++) {
+                const Token & t = tokens[i];
+                bw.put(cCodes[t.code], cLen[t.code]);
+                if (t.code >= 256) {
+                        int j = bitLength(t.dist);
+                        bw.put(pCodes[j], pLen[j]);
+                        if (j > 1) {
+                                bw.put(t.dist - (1 << (j - 1)), j - 1);
+                        }
+                }
+        }
+}
+
+// greedy matching, the longest of the LH5_CHAIN latest candidates
+static std::vector<Token> lzTokens(const std::vector<uint8_t> & data) {
+        const int n = data.size();
+        std::vector<int> head(1 << 16, -1), prev(n, -1);
+        std::vector<Token> tokens;
+        auto hash = [&](int i) { return ((data[i] << 8) ^ (data[i+1] << 4) ^ data[i+2]) & 0xffff; };
+        auto insert = [&](int i) {
+                if (i + LH5_THRESHOLD <= n) {
+                        int h = hash(i);
+                        prev[i] = head[h];
+                        head[h] = i;
+                }
+        };
+        for (int i=0; i<n; ) {
+                int best = 0;
+                int bestDist = 0;
+                if (i + LH5_THRESHOLD <= n) {
+                        int tries = LH5_CHAIN;
+                        for (int p = head[hash(i)]; p >= 0 && tries--; p = prev[p]) {
+                                if (i - p > LH5_DICSIZ - 1) {
+                                        break;
+                                }
+                                int len = 0;
+                                while (len < LH5_MAXMATCH && i + len < n && data[p + len] == data[i + len]) {
+                                        len++;
+                                }
+                                if (len > best) {
+                                        best = len;
+                                        bestDist = i - p - 1;
+                                }
+                        }
+                }
+                if (best >= LH5_THRESHOLD) {
+                        tokens.push_back(Token{(uint16_t)(256 + best - LH5_THRESHOLD), (uint16_t)bestDist});
+                        for (int k=0; k<best; k++) {
+                                insert(i + k);
+                        }
+                        i += best;
+                } else {
+                        tokens.push_back(Token{data[i], 0});
+                        insert(i);
+                        i++;
+                }
+        }
+        return tokens;
+}
+
+static void putLittleEndian32(std::vector<uint8_t> & out, uint32_t value) {
+        for (int i=0; i<4; i++) {
+                out.push_back((uint8_t)(value >> (8*i)));
+        }
+}
+
+} // namespace
+
+
+std::vector<uint8_t> lh5Pack(const std::vector<uint8_t> & data, const char * name) {
+        std::vector<Token> tokens = lzTokens(data);
+        BitWriter bw;
+        for (std::size_t i=0; i<tokens.size(); i += LH5_BLOCK_TOKENS) {
+                encodeBlock(bw, &tokens[i], std::min<std::size_t>(LH5_BLOCK_TOKENS, tokens.size() - i));
+        }
+        bw.finish();
+
+        // level 0 header, as lzhHeader_t: from the id to the (unchecked) CRC16
+        std::vector<uint8_t> header;
+        header.insert(header.end(), "-lh5-", "-lh5-" + 5);
+        putLittleEndian32(header, bw.out.size());
+        putLittleEndian32(header, data.size());
+        putLittleEndian32(header, 0);           // time stamp
+        header.push_back(0x20);                 // attribute
+        header.push_back(0);                    // level
+        header.push_back(strlen(name));
+        header.insert(header.end(), name, name + strlen(name));
+        header.push_back(0);
+        header.push_back(0);
+
+        uint8_t sum = 0;
+        for (uint8_t b : header) {
+                sum += b;
+        }
+        std::vector<uint8_t> file;
+        file.push_back(header.size());
+        file.push_back(sum);
+        file.insert(file.end(), header.begin(), header.end());
+        file.insert(file.end(), bw.out.begin(), bw.out.end());
+        return file;
+}
@@ -0,0 +1,24 @@
+/*
+ * convertym benchmarks
+ * Copyright (C) 2024 Pat Deegan, https://psychogenic.com
+ *
+ * A small -lh5- packer, so that the benchmark corpus can have packed
+ * songs like the real ones without checking binaries in.  It only has
+ * to produce something CLzhDepacker reads back: greedy matching over
+ * a few hash chain candidates, one Huffman block per
+ * LH5_BLOCK_TOKENS tokens, nothing clever.
+ */
+
+#ifndef __LH5PACK__
+#define __LH5PACK__
+
+#include <stdint.h>
+#include <vector>
+
+#define LH5_BLOCK_TOKENS        4000
+
+// data packed as a single file LHA archive entry named name, the way
+// YM files are distributed
+std::vector<uint8_t> lh5Pack(const std::vector<uint8_t> & data, const char * name);
+
+#endif
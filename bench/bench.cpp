@@ -0,0 +1,397 @@
+/*
+ * convertym benchmarks
+ * Copyright (C) 2024 Pat Deegan, https://psychogenic.com
+ *
+ * Usage:
+ * ./convertym-bench [--corpus DIR] [--convertym PATH] [--repeat N] [--save FILE] [--check FILE]
+ *
+ * Runs every song of the built in corpus (see Corpus.h), and every .ym
+ * file under DIR with --corpus, through each stage on its own:
+ *   depack   CLzhDepacker::LzUnpack() of the packed songs, in MB/s of depacked data
+ *   load     ymMusicLoadMemory(), depacking and decoding included
+ *   player   player() alone (ymMusicStepFrame), in frames/s
+ *   update   CYm2149Ex::update() and friends (ymMusicCompute), in samples/s
+ *   convert  the convertym binary over the whole corpus, in files/s, per format
+ * Each time is the best of N runs (3 by default).
+ *
+ * Whatever a stage outputs is checksummed (FNV-1a 64): depacked bytes,
+ * register writes, PCM and the converted files.  --save writes these to
+ * FILE, --check compares them to FILE and fails on any difference, so
+ * that an optimization can be shown to be bit-exact:
+ *   ./convertym-bench --check bench/checksums.txt
+ * bench/checksums.txt has the ones of the built in corpus.
+ *
+ * To build it, from the top directory:
+ *   g++ -O3 -pthread -I. -o convertym-bench bench/bench.cpp bench/Corpus.cpp bench/Lh5Pack.cpp \
+ *     $(ls *.cpp | grep -v convertym.cpp) LZH/LzhLib.cpp
+ */
+
+#include "StSoundLibrary.h"
+#include "YmMusic.h"
+#include "LZH/LZH.H"
+#include "Corpus.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <string>
+#include <map>
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+#include <filesystem>
+
+#define BENCH_REPEAT            3
+#define BENCH_RATE_HZ           44100
+// rendered at once, whole frames (update() runs player() at the start of
+// the last part of a frame) with a 50Hz player at BENCH_RATE_HZ
+#define BENCH_BLOCK_SAMPLES     (882 * 4)
+
+#define FNV_OFFSET              0xcbf29ce484222325ULL
+#define FNV_PRIME               0x100000001b3ULL
+
+typedef struct {
+    int repeat;
+    const char * convertym;
+} BenchOptions;
+
+// what a song took, per stage, 0 where it doesn't apply
+typedef struct {
+    double depackSeconds;
+    uint64_t depackBytes;
+    double loadSeconds;
+    double playerSeconds;
+    uint64_t frames;
+    double updateSeconds;
+    uint64_t samples;
+} SongTimes;
+
+typedef std::map<std::string, uint64_t> Checksums;     // "song stage"
+
+static uint64_t fnv(uint64_t hash, const void * data, std::size_t len) {
+        const uint8_t * p = (const uint8_t *)data;
+        for (std::size_t i=0; i<len; i++) {
+                hash = (hash ^ p[i]) * FNV_PRIME;
+        }
+        return hash;
+}
+
+static double seconds(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static uint32_t readLittleEndian32(const uint8_t * p) {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// LzUnpack() straight on the packed data, the way depackFile() calls it
+static void benchDepack(const CorpusSong & song, const BenchOptions & opts, SongTimes & times, Checksums & sums) {
+        const std::vector<uint8_t> & file = song.data;
+        if (file.size() < 22 || memcmp(&file[2], "-lh5-", 5)) {
+                return;
+        }
+        const uint32_t packed = readLittleEndian32(&file[7]);
+        const uint32_t original = readLittleEndian32(&file[11]);
+        const std::size_t start = file[0] + 2;
+        if (start + packed > file.size()) {
+                return;
+        }
+        std::vector<uint8_t> src(file.begin() + start, file.begin() + start + packed);
+        std::vector<uint8_t> dst(original);
+        CLzhDepacker * depacker = new CLzhDepacker;
+        times.depackSeconds = 1e9;
+        for (int r=0; r<opts.repeat; r++) {
+                auto t0 = std::chrono::steady_clock::now();
+                bool ok = depacker->LzUnpack(src.data(), packed, dst.data(), original);
+                times.depackSeconds = std::min(times.depackSeconds, seconds(t0));
+                if (! ok) {
+                        printf("%s: LH5 depacking error\n", song.name.c_str());
+                        break;
+                }
+        }
+        delete depacker;
+        times.depackBytes = original;
+        sums[song.name + " depack"] = fnv(FNV_OFFSET, dst.data(), dst.size());
+}
+
+static bool load(YMMUSIC * music, const CorpusSong & song) {
+        return ymMusicLoadMemory(music, (void *)song.data.data(), song.data.size());
+}
+
+static bool benchLoad(YMMUSIC * music, const CorpusSong & song, const BenchOptions & opts, SongTimes & times) {
+        times.loadSeconds = 1e9;
+        for (int r=0; r<opts.repeat; r++) {
+                auto t0 = std::chrono::steady_clock::now();
+                if (! load(music, song)) {
+                        printf("%s: %s\n", song.name.c_str(), ymMusicGetLastError(music));
+                        return false;
+                }
+                times.loadSeconds = std::min(times.loadSeconds, seconds(t0));
+        }
+        return true;
+}
+
+// YM2 to YM6: every frame's writes, without rendering
+static void benchPlayer(YMMUSIC * music, const CorpusSong & song, const BenchOptions & opts,
+                        SongTimes & times, Checksums & sums) {
+        if (! ((CYmMusic *)music)->hasRegisterStream()) {
+                return;
+        }
+        times.playerSeconds = 1e9;
+        for (int r=0; r<opts.repeat; r++) {
+                load(music, song);
+                ymMusicPlay(music);
+                // checksummed after, not to time the checksum
+                std::vector<ymCurrentSample_t> writes(((CYmMusic *)music)->GetNbFrame() + 1);
+                uint64_t frames = 0;
+                auto t0 = std::chrono::steady_clock::now();
+                while (frames < writes.size() && ymMusicStepFrame(music, &writes[frames])) {
+                        frames++;
+                }
+                times.playerSeconds = std::min(times.playerSeconds, seconds(t0));
+                times.frames = frames;
+                uint64_t hash = FNV_OFFSET;
+                for (uint64_t i=0; i<frames; i++) {
+                        hash = fnv(hash, writes[i].registers, sizeof(writes[i].registers));
+                }
+                sums[song.name + " player"] = hash;
+        }
+}
+
+static void benchUpdate(YMMUSIC * music, const CorpusSong & song, const BenchOptions & opts,
+                        SongTimes & times, Checksums & sums) {
+        std::vector<ymsample> buffer(BENCH_BLOCK_SAMPLES);
+        times.updateSeconds = 1e9;
+        for (int r=0; r<opts.repeat; r++) {
+                load(music, song);
+                ymMusicInfo_t info;
+                ymMusicGetInfo(music, &info);
+                // MIX songs don't all say they are over, stop a bit after their length
+                const uint64_t most = ((uint64_t)info.musicTimeInMs + 1000) * BENCH_RATE_HZ / 1000;
+                ymMusicPlay(music);
+                uint64_t hash = FNV_OFFSET;
+                uint64_t samples = 0;
+                double took = 0;
+                while (! ymMusicIsOver(music) && samples < most) {
+                        // a clock read per block, the checksum isn't timed
+                        auto t0 = std::chrono::steady_clock::now();
+                        ymMusicCompute(music, buffer.data(), buffer.size());
+                        took += seconds(t0);
+                        hash = fnv(hash, buffer.data(), buffer.size() * sizeof(ymsample));
+                        samples += buffer.size();
+                }
+                times.updateSeconds = std::min(times.updateSeconds, took);
+                times.samples = samples;
+                sums[song.name + " pcm"] = hash;
+        }
+}
+
+static bool writeFile(const std::filesystem::path & path, const std::vector<uint8_t> & data) {
+        std::filesystem::create_directories(path.parent_path());
+        std::ofstream out(path, std::ios::binary);
+        out.write((const char *)data.data(), data.size());
+        return out.good();
+}
+
+static bool readFile(const std::filesystem::path & path, std::vector<uint8_t> & data) {
+        std::ifstream in(path, std::ios::binary);
+        data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        return ! in.bad();
+}
+
+/*
+ * convertym --batch over the corpus (written to dir/in), one thread so
+ * the files/s are comparable between machines.  Only songs with a register
+ * stream, convertym refuses the others.  Returns false if convertym can't
+ * be run.
+ */
+static bool benchConvert(const std::vector<CorpusSong> & corpus, const std::filesystem::path & dir,
+                        const BenchOptions & opts, Checksums & sums) {
+        namespace fs = std::filesystem;
+        static const struct {
+            const char * name;
+            const char * flags;
+            const char * extension;
+        } formats[] = {
+            {"psym1", "", ".psym"},
+            {"psym2", "-f psym2 --wait --index 100", ".psym"},
+            {"psym2z", "-f psym2 --wait --index 100 --compress", ".psym"},
+            {"psym2e", "-f psym2 --wait --events", ".psym"},
+            {"python", "-p", ".py"},
+        };
+        for (const CorpusSong & song : corpus) {
+                if (! writeFile(dir / "in" / song.name, song.data)) {
+                        printf("Can't write the corpus to %s\n", dir.c_str());
+                        return false;
+                }
+        }
+        printf("\n%-10s %8s %10s\n", "convert", "seconds", "files/s");
+        for (const auto & format : formats) {
+                fs::path out = dir / format.name;
+                std::string command = std::string("\"") + opts.convertym + "\" -q " + format.flags
+                                + " --batch \"" + (dir / "in").string() + "\" \"" + out.string() + "\" -j 1";
+                double best = 1e9;
+                for (int r=0; r<opts.repeat; r++) {
+                        fs::remove_all(out);
+                        auto t0 = std::chrono::steady_clock::now();
+                        int status = system(command.c_str());
+                        best = std::min(best, seconds(t0));
+                        if (status != 0) {
+                                printf("%s failed (%d), no convert benchmark\n", command.c_str(), status);
+                                return false;
+                        }
+                }
+                printf("%-10s %8.4f %10.1f\n", format.name, best, corpus.size() / best);
+                for (const CorpusSong & song : corpus) {
+                        std::vector<uint8_t> data;
+                        fs::path converted = out / song.name;
+                        converted.replace_extension(format.extension);
+                        if (readFile(converted, data)) {
+                                sums[song.name + " " + format.name] = fnv(FNV_OFFSET, data.data(), data.size());
+                        }
+                }
+        }
+        return true;
+}
+
+static bool saveChecksums(const char * path, const Checksums & sums) {
+        FILE * out = fopen(path, "w");
+        if (! out) {
+                return false;
+        }
+        for (const auto & sum : sums) {
+                fprintf(out, "%s %016llx\n", sum.first.c_str(), (unsigned long long)sum.second);
+        }
+        return fclose(out) == 0;
+}
+
+// every checksum in the file has to match, missing ones count as a difference
+static int checkChecksums(const char * path, const Checksums & sums) {
+        std::ifstream in(path);
+        if (! in) {
+                printf("Can't read %s\n", path);
+                return -1;
+        }
+        std::string song, stage, hex;
+        int checked = 0, failed = 0;
+        while (in >> song >> stage >> hex) {
+                auto it = sums.find(song + " " + stage);
+                checked++;
+                if (it == sums.end()) {
+                        printf("MISSING %s %s\n", song.c_str(), stage.c_str());
+                        failed++;
+                } else if (it->second != strtoull(hex.c_str(), NULL, 16)) {
+                        printf("DIFFERS %s %s: %016llx, expected %s\n", song.c_str(), stage.c_str(),
+                               (unsigned long long)it->second, hex.c_str());
+                        failed++;
+                }
+        }
+        printf("%d/%d checksums match %s\n", checked - failed, checked, path);
+        return failed;
+}
+
+static void addCorpusDir(const char * dir, std::vector<CorpusSong> & corpus) {
+        namespace fs = std::filesystem;
+        std::vector<fs::path> files;
+        std::error_code ec;
+        for (fs::recursive_directory_iterator it(dir, ec), end; ! ec && it != end; it.increment(ec)) {
+                std::string ext = it->path().extension().string();
+                std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+                if (it->is_regular_file() && ext == ".ym") {
+                        files.push_back(it->path());
+                }
+        }
+        if (ec) {
+                printf("Can't read %s: %s\n", dir, ec.message().c_str());
+        }
+        std::sort(files.begin(), files.end());
+        for (const fs::path & file : files) {
+                CorpusSong song;
+                song.name = fs::relative(file, dir).string();
+                if (readFile(file, song.data)) {
+                        corpus.push_back(song);
+                }
+        }
+}
+
+static double rate(double amount, double seconds) {
+        return seconds > 0 ? amount / seconds : 0;
+}
+
+int main(int argc, char * argv[]) {
+        BenchOptions opts;
+        opts.repeat = BENCH_REPEAT;
+        opts.convertym = "./convertym";
+        const char * savePath = NULL;
+        const char * checkPath = NULL;
+        std::vector<CorpusSong> corpus = makeCorpus();
+
+        for (int i=1; i<argc; i++) {
+                std::string arg(argv[i]);
+                if (arg == "--corpus" && i + 1 < argc) {
+                        addCorpusDir(argv[++i], corpus);
+                } else if (arg == "--convertym" && i + 1 < argc) {
+                        opts.convertym = argv[++i];
+                } else if (arg == "--repeat" && i + 1 < argc) {
+                        opts.repeat = std::max(1, atoi(argv[++i]));
+                } else if (arg == "--save" && i + 1 < argc) {
+                        savePath = argv[++i];
+                } else if (arg == "--check" && i + 1 < argc) {
+                        checkPath = argv[++i];
+                } else {
+                        fprintf(stderr, "Usage: convertym-bench [--corpus DIR] [--convertym PATH] [--repeat N] "
+                                        "[--save FILE] [--check FILE]\n");
+                        return -1;
+                }
+        }
+
+        Checksums sums;
+        SongTimes total = SongTimes();
+        std::vector<CorpusSong> convertible;
+        YMMUSIC * music = ymMusicCreateWithRate(BENCH_RATE_HZ);
+        printf("%-24s %9s %12s %9s %12s %12s\n", "song", "bytes", "depack MB/s", "load ms", "player fr/s", "update Ms/s");
+        for (const CorpusSong & song : corpus) {
+                SongTimes times = SongTimes();
+                benchDepack(song, opts, times, sums);
+                if (benchLoad(music, song, opts, times)) {
+                        benchPlayer(music, song, opts, times, sums);
+                        benchUpdate(music, song, opts, times, sums);
+                        if (((CYmMusic *)music)->hasRegisterStream()) {
+                                convertible.push_back(song);
+                        }
+                }
+                printf("%-24s %9zu %12.1f %9.3f %12.0f %12.2f\n", song.name.c_str(), song.data.size(),
+                       rate(times.depackBytes / 1e6, times.depackSeconds), times.loadSeconds * 1e3,
+                       rate(times.frames, times.playerSeconds), rate(times.samples / 1e6, times.updateSeconds));
+                total.depackSeconds += times.depackSeconds * (times.depackBytes > 0);
+                total.depackBytes += times.depackBytes;
+                total.loadSeconds += times.loadSeconds;
+                total.playerSeconds += times.playerSeconds * (times.frames > 0);
+                total.frames += times.frames;
+                total.updateSeconds += times.updateSeconds * (times.samples > 0);
+                total.samples += times.samples;
+        }
+        ymMusicDestroy(music);
+        printf("%-24s %9s %12.1f %9.3f %12.0f %12.2f\n", "all", "",
+               rate(total.depackBytes / 1e6, total.depackSeconds), total.loadSeconds * 1e3,
+               rate(total.frames, total.playerSeconds), rate(total.samples / 1e6, total.updateSeconds));
+
+        // the corpus as files, for convertym
+        char dir[] = "/tmp/convertym-bench-XXXXXX";
+        if (mkdtemp(dir)) {
+                benchConvert(convertible, dir, opts, sums);
+                std::error_code ec;
+                std::filesystem::remove_all(dir, ec);
+        } else {
+                printf("Can't make a temporary directory, no convert benchmark\n");
+        }
+
+        if (savePath && ! saveChecksums(savePath, sums)) {
+                printf("Can't write %s\n", savePath);
+                return -2;
+        }
+        if (checkPath) {
+                return checkChecksums(checkPath, sums) ? -3 : 0;
+        }
+        return 0;
+}
@@ -3,7 +3,14 @@
  * Copyright (C) 2024 Pat Deegan, https://psychogenic.com
  * 
  * Usage:
- * ./convertym [-p] infile.ym outfile.psym
+ * ./convertym [-p | -f psym1|psym2|python] [--wait] [--index N] [--compress] [--loop] [--emulate | --events] [-j N] infile.ym outfile.psym
+ * ./convertym [-p | -f psym1|psym2|python] [--wait] [--index N] [--compress] [--loop] [--emulate | --events] --batch indir outdir [-j N]
+ * ./convertym -w [-r RATE] [-j N] [--segment SECONDS] infile.ym outfile.wav
+ * ./convertym [-p | -f psym1|psym2|python] [--index N] [--loop] [--emulate | --events] --stream DEVICE infile.ym
+ * ./convertym --serve[=SOCKET] [-j N] [options], JSON lines requests, see Serve.h
+ * any of which with --stats (or --stats=json) reports where the time went on stderr,
+ * --cache DIR to keep converted files there and copy them back for the same song and options,
+ * -q for no messages at all, -v for a dump of every sample too
  * 
  * converts a YM file, e.g.from
  * http://antarctica.no/stuff/atari/YM2/Misc.Games/
@@ -18,9 +25,13 @@
  * project on tiny tapeout 5:
  * https://tinytapeout.com/runs/tt05/tt_um_rejunity_ay8913
  * 
- * Two file formats are available by default: 
- *   - the "psym" described below
- *   - pure python (using the -p flag)
+ * Three file formats are available: 
+ *   - the "psym" described below (the default, or -f psym1)
+ *   - PSYM2, smaller and quicker to decode (-f psym2)
+ *   - pure python (using the -p flag, or -f python)
+ * or, with -w (or -f wav), the song is rendered to a mono 16 bits WAV
+ * file at RATE Hz (-r, 44100 by default), e.g. as a reference to compare
+ * the hardware against.
  * 
  * PSYM:
  * The file format produced is a header followed by N samples
@@ -37,15 +48,40 @@
          * Followed by NUMSAMPS entry of form:
          *  NUMREGSETTINGS (1 byte)
          *  REGISTER (1 byte) and VALUE (1 byte) (NUMREGSETTINGS times)
+ * If the output can't seek (outfile "-" for stdout, a pipe...) NUMSAMPS
+ * is all ones and the samples are followed by a 0xff NUMREGSETTINGS, then
+ * the real NUMSAMPS (8 bytes, little end).
  * 
  * 
+ * PSYM2:
+ * Same header, with PSYM2 as the magic and a FLAGS byte (1 byte, the bits
+ * below, PSYM2_FLAG_* in PsymWriter.h) after NUMSAMPS.  Each sample is a
+ * MASK (2 bytes, little end) where bit N set means register N is written,
+ * followed by one VALUE byte per set bit, lowest register first.  With --wait (FLAGS bit 0), a MASK of 0
+ * is followed by a COUNT (1 byte) of frames where nothing changes.
+ * With --index N (FLAGS bit 1), an INDEXOFFSET (8 bytes, little end) follows
+ * FLAGS and points to a keyframe index after the samples, see the README.
+ * With --compress (FLAGS bit 2), a wait of COUNT 0 is a repeat instead:
+ * OFFSET (4 bytes, little end) and ENTRIES (1 byte), play the ENTRIES
+ * entries at OFFSET in the file again then carry on after the repeat.
+ * With --loop (FLAGS bit 3), LOOPFRAME, LOOPOFFSET and LOOPEND (4 bytes
+ * each, little end) and REGISTERS (14 bytes) follow FLAGS (and INDEXOFFSET):
+ * on getting to the entry at LOOPEND, write REGISTERS and go on from the
+ * entry at LOOPOFFSET, which starts frame LOOPFRAME.
+ * With --events (FLAGS bit 4), a MASK with bit 15 set is NUM (the low bits)
+ * writes within the last frame of the entry before: TIME (2 bytes, little
+ * end, microseconds into that frame), REGISTER (1 byte) and VALUE (1 byte).
+ * Bits 14 and 15 are otherwise reserved, a MASK of
+ * 0xffff ends the samples of an unseekable output and is followed by
+ * NUMSAMPS (8 bytes, little end).
+ * 
  * Pure Python:
  *      Will output a file with a Song = []
  *      Each entry in the list is a sample.
  *      Each entry in the sample is a register setting, (REG, VAL)
  *       SongInfo = {'clock': 2000000, 'rate': 2, 'num': 3646}
  *       Song = [
- *               [(0,0),(1,0),(2,0),(3,0),(4,0),(5,0),(6,0),(7,255),(8,0),(9,0),(10,0),(11,0),(12,0),(13,0),(14,0),(15,0)]
+ *               [(0,0),(1,0),(2,0),(3,0),(4,0),(5,0),(6,0),(7,255),(8,0),(9,0),(10,0),(11,0),(12,0),(13,0)]
  *               [(4,255),(7,251),(10,8),(13,15)]
  *               [(0,214),(7,250),(8,9)],
  *               # ...
@@ -56,7 +92,7 @@
  * https://github.com/arnaud-carre/StSound/tree/main/StSoundLibrary
  * 
  * I just stick this file in there, then build and link all the files statically, e.g.
- *   for i in *.cpp; do echo $i; g++ -ggdb -g3 -O3 -c $i; done; g++ -o convertym *.o
+ *   for i in *.cpp; do echo $i; g++ -ggdb -g3 -O3 -pthread -c $i; done; g++ -pthread -o convertym *.o
  * 
  * For a sample of how I actually use the file, see
  * https://github.com/psychogenic/test_rejunity_ay8913
@@ -64,199 +100,1563 @@
 
 #include "StSoundLibrary.h"
 #include "YmMusic.h"
+#include "PsymWriter.h"
+#include "Serve.h"
+#include "Stream.h"
+#include "Sha256.h"
 #include <iostream>
 #include <vector>
 #include <fstream>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <filesystem>
+#include <bitset>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #define SKIP_DUPS
 #define CLOCK_FREQ_HZ 2000000
 #define SAMPLE_RATE_HZ  50
+#define WAV_RATE_HZ     44100
+// a WAV render of a YM song is split in parts this long, over the -j threads
+#define SEGMENT_SECONDS 10
+// --cache: bump when an output format changes, older entries are then misses
+#define CACHE_VERSION   2
+// --serve: longest request line (inline songs included), pending connections
+#define SERVE_LINE_MAX  (256*1024*1024)
+#define SERVE_BACKLOG   64
+
+typedef enum {
+    FormatPSYM1 = 0,
+    FormatPSYM2,
+    FormatPython,
+    FormatWAV           // rendered PCM rather than registers
+} OutputFormat;
+
+// how much goes to stdout, the output file aside
+typedef enum {
+    LogQuiet = 0,
+    LogInfo,            // song info, what was written
+    LogDebug            // every sample too
+} LogLevel;
+
+// build with -DLOG_LEVEL_MAX=LogInfo to compile the per sample dump out
+#ifndef LOG_LEVEL_MAX
+#define LOG_LEVEL_MAX LogDebug
+#endif
+
+// printf() when at level, arguments aren't even evaluated otherwise.
+// No std::endl: stdout is only flushed when its buffer is full
+#define LOG(opts, level, ...) do { \
+        if ((level) <= LOG_LEVEL_MAX && (opts).logLevel >= (level)) { printf(__VA_ARGS__); } \
+    } while (0)
+
+typedef enum {
+    StatsOff = 0,
+    StatsText,
+    StatsJSON
+} StatsFormat;
 
 typedef struct {
-    uint8_t reg;
-    uint8_t val;
-} RegisterValue;
+    OutputFormat format;
+    bool skip_duplicates;
+    bool waits;         // unchanged frames as waits, rather than repeating a register
+    uint32_t indexInterval;     // keyframe every that many frames, 0 for none
+    bool repeats;       // PSYM2 back references to runs of earlier entries
+    bool loop;          // where the song loops to, with what to restore then
+    bool events;        // SID, drums and sync buzzer as writes within frames
+    LogLevel logLevel;
+    bool emulate;       // run the player and chip emulation rather than reading the stream
+    uint32_t clockFreq;
+    uint8_t rateHz;
+    int wavRate;        // WAV sample rate
+    unsigned renderThreads;     // to render one WAV
+    int segmentSeconds;
+    StatsFormat stats;
+    // --serve: the song and the output in memory rather than files, NULL for files
+    const std::vector<uint8_t> * songData;
+    std::vector<uint8_t> * output;
+    uint64_t * numSamples;      // set to how many samples were written, unless NULL
+    std::string cacheDir;       // --cache, empty for none
+    CStreamRing * stream;       // --stream: each frame's output goes there as it's captured, NULL for none
+} ConvertOptions;
 
+/*
+ * --stats, summed over the files converted.  The library times its own
+ * phases (load), the rest is timed here once per file, the counters
+ * are only kept when asked for.
+ */
 typedef struct {
-    uint8_t num;
-    RegisterValue values[YMNUMREGISTERS];
-    
-} RegisterSettings;
+    ymStats_t load;             // read, depack, decode, deinterleave, WAV writes
+    uint64_t emulateNs;         // capture or render, streamed depacking and writes taken out
+    uint64_t writeNs;           // PSYM, python and parallel WAV writes, waiting on a --stream device
+    uint64_t totalNs;
+    uint64_t files;
+    uint64_t frames;
+    uint64_t registerWrites;    // output
+    uint64_t duplicates;        // written by the song, left out as unchanged
+    uint64_t bytesOut;
+    uint64_t peakBuffer;        // output buffered at once, in bytes
+    uint64_t cacheHits;         // files copied out of the --cache rather than converted
+    StreamCounters stream;      // --stream, frames is 0 otherwise
+} ConvertStats;
 
+static uint64_t nowNs() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
-int main(int argc, char* argv[]) {
-        const char * infile;
-        const char * outfile;
-        bool purePython = false;
-        uint32_t clockFreq = CLOCK_FREQ_HZ;
+static void addStats(ConvertStats & to, const ConvertStats & from) {
+        to.load.readNs += from.load.readNs;
+        to.load.depackNs += from.load.depackNs;
+        to.load.decodeNs += from.load.decodeNs;
+        to.load.deInterleaveNs += from.load.deInterleaveNs;
+        to.load.writeNs += from.load.writeNs;
+        to.load.peakBuffer = std::max(to.load.peakBuffer, from.load.peakBuffer);
+        to.emulateNs += from.emulateNs;
+        to.writeNs += from.writeNs;
+        to.totalNs += from.totalNs;
+        to.files += from.files;
+        to.frames += from.frames;
+        to.registerWrites += from.registerWrites;
+        to.duplicates += from.duplicates;
+        to.bytesOut += from.bytesOut;
+        to.peakBuffer = std::max(to.peakBuffer, from.peakBuffer);
+        to.cacheHits += from.cacheHits;
+        to.stream.frames += from.stream.frames;
+        to.stream.startNs = std::max(to.stream.startNs, from.stream.startNs);
+        to.stream.underruns += from.stream.underruns;
+        to.stream.jitterMaxNs = std::max(to.stream.jitterMaxNs, from.stream.jitterMaxNs);
+        to.stream.jitterSumNs += from.stream.jitterSumNs;
+        to.stream.latencyMaxNs = std::max(to.stream.latencyMaxNs, from.stream.latencyMaxNs);
+}
+
+static const char * statsNames[] = {"read", "depack", "decode", "deinterleave", "emulate", "write", "total"};
+
+static void statsTimes(const ConvertStats & stats, uint64_t * ns) {
+        const uint64_t times[] = {stats.load.readNs, stats.load.depackNs, stats.load.decodeNs,
+                                  stats.load.deInterleaveNs, stats.emulateNs,
+                                  stats.writeNs + stats.load.writeNs, stats.totalNs};
+        std::copy(times, times + 7, ns);
+}
+
+// the --stats=json line, also what --serve replies with
+static std::string statsJSON(const ConvertStats & stats) {
+        uint64_t ns[7];
+        statsTimes(stats, ns);
+        const uint64_t peak = std::max(stats.peakBuffer, stats.load.peakBuffer);
+        char line[256];
+        snprintf(line, sizeof(line), "{\"files\": %llu, \"frames\": %llu, \"register_writes\": %llu, "
+                        "\"duplicates\": %llu, \"bytes_out\": %llu, \"peak_buffer\": %llu, \"cache_hits\": %llu",
+                        (unsigned long long)stats.files, (unsigned long long)stats.frames,
+                        (unsigned long long)stats.registerWrites, (unsigned long long)stats.duplicates,
+                        (unsigned long long)stats.bytesOut, (unsigned long long)peak,
+                        (unsigned long long)stats.cacheHits);
+        std::string json = line;
+        for (int i=0; i<7; i++) {
+                json += std::string(", \"") + statsNames[i] + "_ns\": " + std::to_string(ns[i]);
+        }
+        if (stats.stream.frames) {
+                const StreamCounters & s = stats.stream;
+                snprintf(line, sizeof(line), ", \"stream_frames\": %llu, \"stream_start_ns\": %llu, "
+                                "\"stream_underruns\": %llu, \"stream_jitter_max_ns\": %llu, "
+                                "\"stream_jitter_mean_ns\": %llu, \"stream_latency_max_ns\": %llu",
+                                (unsigned long long)s.frames, (unsigned long long)s.startNs,
+                                (unsigned long long)s.underruns, (unsigned long long)s.jitterMaxNs,
+                                (unsigned long long)(s.jitterSumNs / s.frames), (unsigned long long)s.latencyMaxNs);
+                json += line;
+        }
+        return json + "}";
+}
+
+static void printStats(const ConvertStats & stats, StatsFormat format) {
+        if (format == StatsJSON) {
+                std::cerr << statsJSON(stats) << std::endl;
+                return;
+        }
+        uint64_t ns[7];
+        statsTimes(stats, ns);
+        const uint64_t peak = std::max(stats.peakBuffer, stats.load.peakBuffer);
+        char line[256];
+        snprintf(line, sizeof(line), "stats: %llu file%s, %llu frames, %llu register writes, "
+                        "%llu duplicates, %llu bytes out, %llu bytes peak buffer, %llu cache hits",
+                        (unsigned long long)stats.files, stats.files == 1 ? "" : "s", (unsigned long long)stats.frames,
+                        (unsigned long long)stats.registerWrites, (unsigned long long)stats.duplicates,
+                        (unsigned long long)stats.bytesOut, (unsigned long long)peak,
+                        (unsigned long long)stats.cacheHits);
+        std::cerr << line << std::endl;
+        for (int i=0; i<7; i++) {
+                snprintf(line, sizeof(line), "  %-14s%10.6fs", statsNames[i], ns[i] / 1e9);
+                std::cerr << line << std::endl;
+        }
+        if (stats.stream.frames) {
+                const StreamCounters & s = stats.stream;
+                snprintf(line, sizeof(line), "  streamed %llu frames, the first after %.3fms, %llu underruns, "
+                                "jitter %.3fms at most (%.3fms mean), %.3fms from capture to device at most",
+                                (unsigned long long)s.frames, s.startNs / 1e6, (unsigned long long)s.underruns,
+                                s.jitterMaxNs / 1e6, s.jitterSumNs / 1e6 / s.frames, s.latencyMaxNs / 1e6);
+                std::cerr << line << std::endl;
+        }
+}
+
+static CPsymWriter * newFormatWriter(const ConvertOptions & opts) {
+        switch (opts.format) {
+        case FormatPSYM2:
+                return new CPsym2Writer;
+        case FormatPython:
+                return new CPythonWriter;
+        default:
+                return new CPsym1Writer;
+        }
+}
+
+/*
+ * A frame's register writes as values plus a mask, bit N set if register N
+ * is written.
+ */
+static uint16_t frameWrites(const ymCurrentSample_t & frame, uint8_t * registers) {
+        uint16_t written = 0;
+        for (int i=0; i<YMNUMREGISTERS; i++) {
+                registers[i] = frame.registers[i] >= 0 ? frame.registers[i] : 0;
+                if (frame.registers[i] >= 0) {
+                        written |= 1 << i;
+                }
+        }
+        return written;
+}
+
+/*
+ * next frame's writes, from the player and chip emulation or straight
+ * from the YM stream (same writes, much quicker).  False once the song is over.
+ * With effects, the emulation also gives the writes the SID, drums and sync
+ * buzzer make during the frame.
+ */
+static bool nextFrame(YMMUSIC * song, bool emulate, uint8_t * registers, uint16_t & written,
+                      std::vector<ymEffectEvent_t> * effects, int & numEffects) {
+        numEffects = 0;
+        if (effects) {
+                ymCurrentSample_t frame;
+                if (! ymMusicStepFrameEvents(song, &frame, effects->data(), effects->size(), &numEffects)) {
+                        return false;
+                }
+                written = frameWrites(frame, registers);
+                return true;
+        }
+        if (emulate) {
+                ymCurrentSample_t frame;
+                if (! ymMusicStepFrame(song, &frame)) {
+                        return false;
+                }
+                written = frameWrites(frame, registers);
+                return true;
+        }
+        return ymMusicStepFrameDirect(song, registers, &written);
+}
+
+// bit N set if registers[N] differs from previous[N]
+static inline uint16_t changedRegisters(const uint8_t * registers, const uint8_t * previous) {
+#ifdef __SSE2__
+        __m128i same = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)registers),
+                                      _mm_loadu_si128((const __m128i *)previous));
+        return ~_mm_movemask_epi8(same);
+#else
+        uint16_t changed = 0;
+        for (int i=0; i<YMNUMREGISTERS; i++) {
+                if (registers[i] != previous[i]) {
+                        changed |= 1 << i;
+                }
+        }
+        return changed;
+#endif
+}
+
+static CPsymWriter * newWriter(const ConvertOptions & opts) {
+        CPsymWriter * writer = newFormatWriter(opts);
+        writer->setWaits(opts.waits);
+        writer->setIndex(opts.indexInterval);
+        writer->setRepeats(opts.repeats);
+        writer->setEvents(opts.events);
+        return writer;
+}
+
+// infile, or the bytes of opts.songData when there are
+static bool loadSong(YMMUSIC * song, const char * infile, const ConvertOptions & opts) {
+        if (opts.songData) {
+                return ymMusicLoadMemoryNoCopy(song, (void *)opts.songData->data(), opts.songData->size());
+        }
+        return ymMusicLoad(song, infile);
+}
+
+static void printSongInfo(YMMUSIC * song, const ConvertOptions & opts) {
+        ymMusicInfo_t info;
+        ymMusicGetInfo(song, &info);
+        LOG(opts, LogInfo, "Name: %s\nAuthor: %s\nComment: %s\nDuration: %d:%d\nDriver: %s\n",
+            info.pSongName, info.pSongAuthor, info.pSongComment,
+            (int)info.musicTimeInSec/60, (int)info.musicTimeInSec%60, info.pSongPlayer);
+}
+
+// frames first to end of a song, worked on from a checkpoint at frame from
+typedef struct {
+    int from;                   // played again up to first, for what the output needs to have seen
+    int first;
+    int end;
+} SongSegment;
+
+// nbFrame frames in segments of segFrames, each checkpointed warmFrames ahead
+static std::vector<SongSegment> splitSong(int nbFrame, int segFrames, int warmFrames) {
+        std::vector<SongSegment> spans;
+        for (int first=0; first<nbFrame; first+=segFrames) {
+                SongSegment span;
+                span.first = first;
+                span.end = std::min(nbFrame, first + segFrames);
+                span.from = std::max(0, first - warmFrames);
+                spans.push_back(span);
+        }
+        return spans;
+}
+
+// the checkpoint pass: frames played ahead with no output
+typedef std::function<void(int frames)> SegmentSkip;
+// on a worker, segment i with mine at its checkpoint; false fails them all
+typedef std::function<bool(YMMUSIC * mine, int i, const SongSegment & span)> SegmentWork;
+// on the caller, each segment worked in order; false stops there
+typedef std::function<bool(int i)> SegmentDone;
+
+/*
+ * one YM2 to YM6 song, already loaded in song, in segments on numThreads
+ * threads.  A quick pass through song (skip) saves the player state at
+ * the from of every segment.  Each worker loads the song in its own
+ * instance, restores a state and works that segment out of it, no more
+ * than 2 segments each ahead of the ones done; the caller is handed each
+ * one in order as soon as it is there.  False if a worker failed (with
+ * why in error), not if done stopped.
+ */
+static bool runSegments(YMMUSIC * song, const char * infile, const ConvertOptions & opts,
+                        unsigned numThreads, const std::vector<SongSegment> & spans,
+                        const SegmentSkip & skip, const SegmentWork & work, const SegmentDone & done,
+                        std::string & error) {
+        CYmMusic * music = (CYmMusic*)song;
+        const int nbSegment = spans.size();
         
-        uint8_t rateHz = SAMPLE_RATE_HZ;
+        // chips and songs are created up front, their constructor touches shared tables
+        std::vector<ymPlayerState_t> states(nbSegment);
+        std::vector<char> worked(nbSegment, false);
+        std::vector<YMMUSIC *> songs;
+        for (unsigned t=0; t<numThreads; t++) {
+                songs.push_back(ymMusicCreateWithRate(opts.wavRate));
+        }
         
-        ymsample buf[10];
-        std::vector<RegisterSettings*> samples;
-        bool skip_duplicates = false;
-        #ifdef SKIP_DUPS
-        skip_duplicates = true;
-        #endif
-        if (argc < 3) {
-            std::cerr << "Usage: ymconvert [-p] FILE.ym OUTFILE" << std::endl;
-            return -1;
+        std::mutex lock;
+        std::condition_variable changed;
+        int statesReady = 0;
+        int nextSegment = 0;
+        int handed = 0;
+        bool failed = false;
+        
+        auto worker = [&](YMMUSIC * mine) {
+                bool loaded = loadSong(mine, infile, opts);
+                ymMusicSetLoopMode(mine, YMFALSE);
+                ymMusicPlay(mine);
+                std::unique_lock<std::mutex> guard(lock);
+                while (! failed && nextSegment < nbSegment) {
+                        int i = nextSegment++;
+                        // don't get too far ahead of the caller
+                        changed.wait(guard, [&] { return failed ||
+                                (i < statesReady && i < handed + 2 * (int)numThreads); });
+                        if (failed || ! loaded) {
+                                failed = true;
+                                break;
+                        }
+                        guard.unlock();
+                        ((CYmMusic *)mine)->restoreState(&states[i]);
+                        bool ok = work(mine, i, spans[i]);
+                        guard.lock();
+                        if (! ok) {
+                                failed = true;
+                                break;
+                        }
+                        worked[i] = true;
+                        changed.notify_all();
+                }
+                changed.notify_all();
+        };
+        
+        std::vector<std::thread> workers;
+        for (unsigned t=0; t<numThreads; t++) {
+                workers.push_back(std::thread(worker, songs[t]));
         }
         
-        if (argc > 3) {
-                if (std::string(argv[1]) == "-p") {
-                        std::cout << "Pure python" << std::endl;
-                        purePython = true;
+        // the checkpoints, workers start on a segment as soon as its state is there
+        ymMusicSetLoopMode(song, YMFALSE);
+        int frame = 0;
+        for (int i=0; i<nbSegment; i++) {
+                skip(spans[i].from - frame);
+                frame = spans[i].from;
+                std::lock_guard<std::mutex> guard(lock);
+                music->saveState(&states[i]);
+                statesReady++;
+                changed.notify_all();
+        }
+        
+        bool ok = true;
+        for (int i=0; i<nbSegment; i++) {
+                {
+                        std::unique_lock<std::mutex> guard(lock);
+                        changed.wait(guard, [&] { return worked[i] || failed; });
+                        if (! worked[i]) {
+                                ok = false;
+                                break;
+                        }
                 }
-                infile = argv[2];
-                outfile = argv[3];
-        } else {
-                
-                infile = argv[1];
-                outfile = argv[2];
+                bool carryOn = done(i);
+                std::lock_guard<std::mutex> guard(lock);
+                handed++;
+                if (! carryOn) {
+                        failed = true;
+                        changed.notify_all();
+                        break;
+                }
+                changed.notify_all();
         }
         
-        YMMUSIC * song = ymMusicCreate();
+        for (std::thread & w : workers) {
+                w.join();
+        }
+        for (YMMUSIC * s : songs) {
+                ymMusicDestroy(s);
+        }
+        if (! ok) {
+                error = "Can't load the song again";
+        }
+        return ok;
+}
+
+/*
+ * render one YM2 to YM6 song, already loaded in song, to WAV on numThreads threads,
+ * through runSegments().  Checkpoints (fastForward) are a few frames ahead of
+ * every segment: the worker renders those frames again so the DC adjuster has
+ * its history back, then renders the segment.  Segments are written in order
+ * as they are done, the file is the same as a serial render.
+ */
+static bool renderSegments(YMMUSIC * song, const char * infile, const char * outfile,
+                        const ConvertOptions & opts, unsigned numThreads, std::string & error,
+                        ConvertStats * stats) {
         CYmMusic * music = (CYmMusic*)song;
-        if (! ymMusicLoad(song, infile)) {
-            std::cerr << "Can't find " << infile << std::endl;
-            return -2;
+        const int vbl = opts.wavRate / music->getPlayerRate();
+        const int nbFrame = music->GetNbFrame();
+        const int segFrames = opts.segmentSeconds * music->getPlayerRate();
+        // the DC adjuster has to see a buffer of samples, plus the two the
+        // low-pass filter remembers
+        const int warmFrames = (DC_ADJUST_BUFFERLEN + 2 + vbl - 1) / vbl;
+        
+        const uint64_t nbSample = (uint64_t)nbFrame * vbl;
+        if (nbSample > (0x7fffffff - 36) / sizeof(ymsample)) {
+            error = "Song too long for a WAV file";
+            return false;
         }
         
-        ymMusicInfo_t info;
-        ymMusicGetInfo(song, &info);
-        std::cout << "Name: " << info.pSongName << std::endl;
-        std::cout << "Author: " << info.pSongAuthor << std::endl;
-        std::cout << "Comment: " << info.pSongComment << std::endl;
-        std::cout << "Duration: " << info.musicTimeInSec/60 << ":" << info.musicTimeInSec%60 << std::endl;
-        std::cout << "Driver: " << info.pSongPlayer << std::endl;
-        std::cout << music;
+        const std::vector<SongSegment> spans = splitSong(nbFrame, segFrames, warmFrames);
+        std::vector<std::vector<ymsample>> pcm(spans.size());
+        std::mutex bufferLock;
+        uint64_t buffered = 0;          // bytes of segments done, not written yet
+        uint64_t peak = 0;
+        
+        auto render = [&](YMMUSIC * mine, int i, const SongSegment & span) {
+                if (span.first > span.from) {
+                        std::vector<ymsample> warmup((size_t)(span.first - span.from) * vbl);
+                        ymMusicCompute(mine, warmup.data(), warmup.size());
+                }
+                pcm[i].resize((size_t)(span.end - span.first) * vbl);
+                ymMusicCompute(mine, pcm[i].data(), pcm[i].size());
+                std::lock_guard<std::mutex> guard(bufferLock);
+                buffered += pcm[i].size() * sizeof(ymsample);
+                peak = std::max(peak, buffered);
+                return true;
+        };
+        
+        uint64_t writeStart = stats ? nowNs() : 0;
+        uint64_t writeNs = 0;
+        FILE * out = fopen(outfile, "wb");
+        uint8_t header[WAVE_HEADER_SIZE];
+        music->waveHeader(header, (ymu32)nbSample);
+        bool ok = out && fwrite(header, 1, sizeof(header), out) == sizeof(header);
+        if (stats) {
+                writeNs += nowNs() - writeStart;
+        }
+        const uint16_t one = 1;
+        const bool swap = *(const uint8_t *)&one == 0;     // WAV is little endian
+        auto write = [&](int i) {
+                if (swap) {
+                        for (ymsample & s : pcm[i]) {
+                                s = (ymsample)(((uint16_t)s >> 8) | ((uint16_t)s << 8));
+                        }
+                }
+                if (stats) {
+                        writeStart = nowNs();
+                }
+                ok = fwrite(pcm[i].data(), sizeof(ymsample), pcm[i].size(), out) == pcm[i].size();
+                if (stats) {
+                        writeNs += nowNs() - writeStart;
+                }
+                std::lock_guard<std::mutex> guard(bufferLock);
+                buffered -= pcm[i].size() * sizeof(ymsample);
+                std::vector<ymsample>().swap(pcm[i]);
+                return ok;
+        };
+        
         ymMusicPlay(song);
-        int count = 0;
-        int chip_register_value[YMNUMREGISTERS];
-        for (uint8_t i=0; i<YMNUMREGISTERS; i++) {
-                chip_register_value[i] = -1;
+        bool rendered = ! ok || runSegments(song, infile, opts, numThreads, spans,
+                                            [&](int frames) { music->fastForward(frames); },
+                                            render, write, error);
+        
+        if (stats) {
+                writeStart = nowNs();
+        }
+        if (out && fclose(out) != 0) {
+                ok = false;
+        }
+        if (stats) {
+                stats->writeNs += writeNs + nowNs() - writeStart;
+                stats->peakBuffer = std::max(stats->peakBuffer, peak);
+        }
+        if (! rendered) {
+                return false;
+        }
+        if (! ok) {
+                error = std::string("Can't write ") + outfile;
+                return false;
+        }
+        return true;
+}
+
+typedef struct {
+    uint8_t registers[YMNUMREGISTERS];
+    uint16_t written;
+    uint32_t firstEffect;       // its effects in CaptureSegment::effects
+    uint32_t numEffects;
+} CapturedFrame;
+
+typedef struct {
+    std::vector<CapturedFrame> frames;
+    std::vector<ymEffectEvent_t> effects;
+} CaptureSegment;
+
+// what becomes of each frame a song plays: its writes, then its effects
+typedef std::function<void(const uint8_t * registers, uint16_t written,
+                           const ymEffectEvent_t * effects, int numEffects)> FrameSink;
+
+static void captureSink(void * user, ymu32, const ymCurrentSample_t * writes,
+                        const ymEffectEvent_t * effects, ymint numEffects) {
+        CaptureSegment & seg = *(CaptureSegment *)user;
+        CapturedFrame captured;
+        captured.written = frameWrites(*writes, captured.registers);
+        captured.firstEffect = seg.effects.size();
+        captured.numEffects = numEffects;
+        seg.effects.insert(seg.effects.end(), effects, effects + numEffects);
+        seg.frames.push_back(captured);
+}
+
+/*
+ * the emulated player's frames of one YM2 to YM6 song, already loaded
+ * and playing in song, on numThreads threads, handed to sink in order,
+ * through runSegments().  Checkpoints (skipFrames) are at the start of
+ * every segment.  The writes of a frame only depend on its data; its
+ * effects follow on from the checkpoint as they would from the frames
+ * before.  What the output leaves out as unchanged is all worked out by
+ * sink as frames come, in order, so segments don't have to agree on what
+ * the chip was last sent.  The chip reset at the end is the last frame,
+ * as the serial capture has it.
+ */
+static bool captureSegments(YMMUSIC * song, const char * infile, const ConvertOptions & opts,
+                        unsigned numThreads, const FrameSink & sink, std::string & error) {
+        CYmMusic * music = (CYmMusic*)song;
+        const int nbFrame = music->GetNbFrame() + 1;
+        const int segFrames = opts.segmentSeconds * music->getPlayerRate();
+        
+        const std::vector<SongSegment> spans = splitSong(nbFrame, segFrames, 0);
+        std::vector<CaptureSegment> segments(spans.size());
+        
+        auto capture = [&](YMMUSIC * mine, int i, const SongSegment & span) {
+                CaptureSegment & seg = segments[i];
+                seg.frames.reserve(span.end - span.first);
+                return ((CYmMusic *)mine)->captureFrames(span.first, span.end - span.first, captureSink,
+                                                         &seg, opts.events) == span.end - span.first;
+        };
+        auto emit = [&](int i) {
+                CaptureSegment & seg = segments[i];
+                for (const CapturedFrame & f : seg.frames) {
+                        sink(f.registers, f.written, seg.effects.data() + f.firstEffect, f.numEffects);
+                }
+                std::vector<CapturedFrame>().swap(seg.frames);
+                std::vector<ymEffectEvent_t>().swap(seg.effects);
+                return true;
+        };
+        return runSegments(song, infile, opts, numThreads, spans,
+                           [&](int frames) { music->skipFrames(frames); },
+                           capture, emit, error);
+}
+
+/*
+ * render one file to WAV, the song instance sets the sample rate.
+ * On failure, returns false with the reason in error.
+ */
+static bool renderFile(YMMUSIC * song, const char * infile, const char * outfile,
+                        const ConvertOptions & opts, std::string & error, ConvertStats * stats) {
+        if (! loadSong(song, infile, opts)) {
+            error = ymMusicGetLastError(song);
+            return false;
+        }
+        printSongInfo(song, opts);
+        CYmMusic * music = (CYmMusic*)song;
+        ConvertStats before;
+        uint64_t start = 0;
+        if (stats) {
+            before = *stats;
+            start = nowNs();
+        }
+        int segFrames = opts.segmentSeconds * music->getPlayerRate();
+        if (opts.renderThreads > 1 && music->hasRegisterStream() && segFrames > 0
+                        && music->GetNbFrame() > segFrames) {
+            if (! renderSegments(song, infile, outfile, opts, 
+                                 std::min<unsigned>(opts.renderThreads, (music->GetNbFrame() + segFrames - 1) / segFrames),
+                                 error, stats)) {
+                return false;
+            }
+        } else if (! ymMusicWaveCreate(song, (char *)outfile)) {
+            error = ymMusicGetLastError(song);
+            return false;
+        }
+        if (stats) {
+            stats->emulateNs += nowNs() - start 
+                    - (stats->load.depackNs - before.load.depackNs)
+                    - (stats->load.writeNs - before.load.writeNs)
+                    - (stats->writeNs - before.writeNs);
+            if (music->hasRegisterStream()) {
+                stats->frames += music->GetNbFrame();
+            }
+            std::error_code ec;
+            std::uintmax_t size = std::filesystem::file_size(outfile, ec);
+            stats->bytesOut += ec ? 0 : size;
+        }
+        LOG(opts, LogInfo, "rendered to %s at %dHz\n", outfile, opts.wavRate);
+        return true;
+}
+
+// --stream: the output since the last one, the frame just captured, onto the ring.
+// Returns how long it waited for the device to play what's ahead.
+static uint64_t streamPush(CStreamRing & ring, CPsymWriter & writer, uint64_t periodNs, bool last) {
+        StreamFrame * frame;
+        uint64_t start = 0;
+        while (! (frame = ring.back())) {
+                start = start ? start : nowNs();
+                std::this_thread::sleep_for(std::chrono::microseconds(STREAM_POLL_US));
         }
-        while (! ymMusicIsOver(song)) {
-            ymMusicCompute(song,buf,1);
+        writer.take(frame->bytes);
+        frame->periodNs = periodNs;
+        frame->capturedNs = nowNs();
+        frame->last = last;
+        ring.push();
+        return start ? frame->capturedNs - start : 0;
+}
+
+/*
+ * convert one file, using (and reusing) the song instance and writer.
+ * Samples are written out as they are captured.
+ * On failure, returns false with the reason in error.
+ */
+static bool convertSong(YMMUSIC * song, CPsymWriter & writer, const char * infile, const char * outfile,
+                        const ConvertOptions & opts, std::string & error, ConvertStats * stats) {
+        bool skip_duplicates = opts.skip_duplicates;
+        
+        if (opts.format == FormatWAV) {
+            return renderFile(song, infile, outfile, opts, error, stats);
+        }
+        if (! loadSong(song, infile, opts)) {
+            error = ymMusicGetLastError(song);
+            return false;
+        }
+        
+        printSongInfo(song, opts);
+        CYmMusic * music = (CYmMusic*)song;
+        if (! music->hasRegisterStream()) {
+            // MIX1 and YM-Tracker play samples, the chip is never written
+            ymMusicInfo_t info;
+            ymMusicGetInfo(song, &info);
+            error = std::string(info.pSongType) + " songs have no register writes, render them with -w";
+            return false;
+        }
+        if (opts.loop) {
+            // the chip reset is sample 0, song frame N is sample N + 1, and
+            // the reset at the end is where the loop goes back
+            int loopFrame = music->GetLoopFrame();
+            if (loopFrame < 0 || loopFrame >= music->GetNbFrame()) {
+                loopFrame = 0;
+            }
+            writer.setLoop(loopFrame + 1, music->GetNbFrame() + 1);
+            LOG(opts, LogInfo, "Loops from frame %d\n", loopFrame);
+        } else {
+            writer.setLoop(0, 0);
+        }
+        const uint64_t periodNs = 1000000000ULL / std::max(1, music->getPlayerRate());
+        if (opts.stream ? ! writer.openStream(opts.clockFreq, opts.rateHz)
+                        : opts.output ? ! writer.openMemory(opts.output, opts.clockFreq, opts.rateHz)
+                        : ! writer.open(outfile, opts.clockFreq, opts.rateHz)) {
+            error = std::string("Can't write ") + outfile;
+            return false;
+        }
+        ymMusicPlay(song);
+        int count = 0;
+        const uint64_t depackNs = stats ? stats->load.depackNs : 0;
+        const uint64_t start = stats ? nowNs() : 0;
+        // what the chip has been sent so far, bit N of chip_register_set if
+        // register N has been set at all
+        uint8_t chip_register_value[YMNUMREGISTERS] = {0};
+        uint16_t chip_register_set = 0;
+        
+        // whatever the chip reset wrote on load is the first sample, then
+        // step one frame at a time: no need to render any PCM just to find
+        // out which registers were written.  Unless asked for the emulator,
+        // the writes are read straight from the YM stream.
+        uint8_t registers[YMNUMREGISTERS];
+        uint16_t written = frameWrites(*ymMusicGetCurrentSample(song), registers);
+        // the emulation times effect writes in samples at the song's rate
+        std::vector<RegisterEvent> events;
+        uint64_t streamWaitNs = 0;         // --stream: the ring full, the device playing
+        auto emitFrame = [&](const uint8_t * registers, uint16_t written,
+                             const ymEffectEvent_t * effects, int numEffects) {
+            uint16_t changed = written & (changedRegisters(registers, chip_register_value) | ~chip_register_set);
+            
+            // want to set a register if:
+            // skip_dups AND is new
+            //  or
+            // skip_dups and NO new: the first one set, so the frame is still there
+            //  or
+            // not skip dups
+            uint16_t emit = written;
+            if (skip_duplicates) {
+                emit = changed ? changed : (written & -written);
+            }
             
-            if (YMCurrentSample.ready) {
+            uint16_t sent = 0;
+            if (opts.waits && (!written || (skip_duplicates && !changed))) {
+                // nothing for the chip to do, but the frame still takes its time
+                LOG(opts, LogDebug, "Sample %d unchanged\n", count);
+                writer.wait();
+                count++;
+            } else if (emit) {
                 
-                RegisterSettings * settings = new RegisterSettings; // not even deleting, don't care
-                std::cout << "Sample " << count << std::endl;
+                RegisterSettings settings;
+                LOG(opts, LogDebug, "Sample %d\n", count);
                 uint8_t num_set = 0;
-                uint8_t num_new = 0;
-                for (int i=0; i<YMNUMREGISTERS; i++) {
-                        if (YMCurrentSample.registers[i] >=0 ) {
-                                // it is set
-                                if (YMCurrentSample.registers[i] != chip_register_value[i]) {
-                                        // it has changed
-                                        num_new++;
-                                }
-                        }
-                }
-                
                 for (int i=0; i<YMNUMREGISTERS; i++) {
-                    if (YMCurrentSample.registers[i] >=0 ) {
-                        
-                        // want to set this if:
-                        // skip_dups AND is new
-                        //  or
-                        // skip_dups and NO new and none set yet
-                        //  or
-                        // not skip dups
+                    if (emit & (1 << i)) {
+                        settings.values[num_set].reg = i;
+                        settings.values[num_set].val = registers[i];
+                        num_set++;
                         
-                        if ( (!skip_duplicates) || 
-                                (skip_duplicates && (!num_new) && (!num_set))
-                                ||
-                                (skip_duplicates && YMCurrentSample.registers[i] != chip_register_value[i])
-                        ) {
-                                settings->values[num_set].reg = i;
-                                settings->values[num_set].val = YMCurrentSample.registers[i];
-                                num_set++;
-                                
-                                chip_register_value[i] = YMCurrentSample.registers[i];
-                                std::cout << "\t" << i << "," << YMCurrentSample.registers[i] << std::endl;
-                        }
-                    } 
+                        chip_register_value[i] = registers[i];
+                        LOG(opts, LogDebug, "\t%d,%d\n", i, (int)registers[i]);
+                    }
                 }
-                
-                if (num_set) {
-                    settings->num = num_set;
-                    samples.push_back(settings);
-                    count++;
-                } else {
-                    delete settings;
+                chip_register_set |= emit;
+                sent = emit;
+                settings.num = num_set;
+                writer.sample(settings);
+                count++;
+            }
+            if (stats) {
+                unsigned emitted = std::bitset<16>(sent).count();
+                stats->frames++;
+                stats->registerWrites += emitted;
+                stats->duplicates += std::bitset<16>(written).count() - emitted;
+                stats->registerWrites += numEffects;
+            }
+            if (numEffects) {
+                // after the frame's entry, and the chip has them too
+                events.resize(numEffects);
+                for (int i=0; i<numEffects; i++) {
+                    events[i].time = std::min((uint64_t)effects[i].sample * 1000000 / opts.wavRate,
+                                              (uint64_t)PSYM2_EVENTS_TIME_MAX);
+                    events[i].reg = effects[i].reg;
+                    events[i].val = effects[i].value;
+                    chip_register_value[events[i].reg] = events[i].val;
+                    chip_register_set |= 1 << events[i].reg;
+                    LOG(opts, LogDebug, "\t+%dus %d,%d\n", (int)events[i].time, (int)events[i].reg, (int)events[i].val);
                 }
-                ymResetCurrentSample();
+                writer.events(events.data(), events.size());
+            }
+            if (opts.stream) {
+                streamWaitNs += streamPush(*opts.stream, writer, periodNs, false);
+            }
+        };
+        emitFrame(registers, written, NULL, 0);
+        
+        // the emulated player's frames of a long song are captured in parts
+        const int segFrames = opts.segmentSeconds * music->getPlayerRate();
+        if ((opts.emulate || opts.events) && opts.renderThreads > 1 && segFrames > 0
+                        && music->GetNbFrame() >= segFrames) {
+            if (! captureSegments(song, infile, opts,
+                                  std::min<unsigned>(opts.renderThreads, music->GetNbFrame() / segFrames + 1),
+                                  emitFrame, error)) {
+                writer.close();
+                return false;
+            }
+        } else {
+            std::vector<ymEffectEvent_t> effects;
+            int numEffects = 0;
+            if (opts.events) {
+                effects.resize((opts.wavRate / std::max(1, music->getPlayerRate()) + 1) * YM_EFFECT_WRITES_PER_SAMPLE);
+            }
+            while (nextFrame(song, opts.emulate, registers, written, opts.events ? &effects : NULL, numEffects)) {
+                emitFrame(registers, written, effects.data(), numEffects);
             }
         }
-        /*
-         * 
-         * FORMAT
-         * 
-         * header  =========
-         * PSYM1 (5 bytes)
-         * CLOCKFREQ (4 bytes, little end)
-         * SAMPLERATEHz (1 byte)
-         * NUMSAMPS (8 bytes, little end)
-         * /header =========
-         * Followed by NUMSAMPS entry of form:
-         *  NUMREGSETTINGS (1 byte)
-         *  REGISTER (1 byte) and VALUE (1 byte) (NUMREGSETTINGS times)
-         * 
-         */
-        std::cout << "collected " << samples.size() << " samples, writing to " << outfile << std::endl;
-        std::size_t numsamps = samples.size();
-        if (purePython) {
-                
-                std::ofstream fs(outfile, std::ios::out | std::ios::binary);
-                fs << "SongInfo = {'clock': " << clockFreq << ", 'rate': " << (int)rateHz << ", 'num': " << numsamps << "}\n";
-                
-                fs << "Song = [\n";
-                
-                uint8_t reg_count = 0;
-                for (RegisterSettings * s : samples) {
-                        // std::cout << (int)s->num << std::endl;
-                        if (! reg_count) {
-                                fs << "\t";
+        if (stats) {
+            stats->emulateNs += nowNs() - start - (stats->load.depackNs - depackNs) - writer.writeTime() - streamWaitNs;
+        }
+        bool closed = writer.close();
+        if (stats) {
+            stats->writeNs += writer.writeTime() + streamWaitNs;
+            stats->bytesOut += writer.bytesOut();
+            stats->peakBuffer = std::max(stats->peakBuffer, writer.peakBuffer());
+        }
+        if (! closed) {
+                error = std::string("Can't write ") + outfile;
+                return false;
+        }
+        LOG(opts, LogInfo, "wrote %llu samples to %s\n", (unsigned long long)writer.numSamples(), outfile);
+        if (opts.numSamples) {
+                *opts.numSamples = writer.numSamples();
+        }
+        return true;
+}
+
+static bool readWhole(const char * path, std::vector<uint8_t> & data) {
+        FILE * in = fopen(path, "rb");
+        if (! in) {
+                return false;
+        }
+        char buffer[64*1024];
+        std::size_t n;
+        data.clear();
+        while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+                data.insert(data.end(), buffer, buffer + n);
+        }
+        bool ok = ! ferror(in);
+        fclose(in);
+        return ok;
+}
+
+static bool writeWhole(const char * path, const std::vector<uint8_t> & data) {
+        bool toStdout = std::string(path) == "-";
+        FILE * out = toStdout ? stdout : fopen(path, "wb");
+        if (! out) {
+                return false;
+        }
+        bool ok = fwrite(data.data(), 1, data.size(), out) == data.size();
+        ok = (toStdout ? fflush(out) : fclose(out)) == 0 && ok;
+        return ok;
+}
+
+/*
+ * --cache: what every option that changes the output is set to, the first
+ * line of a cache file, the second has the SHA-256 of the song, the third
+ * the number of samples and the output follows.  Bump CACHE_VERSION when
+ * an output format changes.
+ */
+static std::string cacheOptions(const ConvertOptions & opts, std::size_t songSize) {
+        char line[160];
+        snprintf(line, sizeof(line), "convertym-cache %d size %zu format %d dups %d wait %d index %u compress %d "
+                        "loop %d events %d emulate %d clock %u rate %u wavrate %d\n",
+                        CACHE_VERSION, songSize, (int)opts.format, (int)opts.skip_duplicates, (int)opts.waits,
+                        (unsigned)opts.indexInterval, (int)opts.repeats, (int)opts.loop, (int)opts.events,
+                        (int)opts.emulate, (unsigned)opts.clockFreq, (unsigned)opts.rateHz, opts.wavRate);
+        return line;
+}
+
+/*
+ * convertSong(), through the --cache: outputs are kept under a hash of the
+ * song file as it is (packed or not) and of the options, so an unchanged
+ * song is only read, hashed and its output copied back, never depacked.
+ * It's a hit only if the entry has the same options and song digest too,
+ * a file name shared by two songs is a miss, not the other's output.
+ * A miss is converted into memory, then written out and stored.
+ */
+static bool convertCached(YMMUSIC * song, CPsymWriter & writer, const char * infile, const char * outfile,
+                        const ConvertOptions & opts, std::string & error, ConvertStats * stats) {
+        namespace fs = std::filesystem;
+        std::vector<uint8_t> input;
+        const std::vector<uint8_t> * data = opts.songData;
+        if (! data) {
+                if (! readWhole(infile, input)) {
+                        error = "File not Found";
+                        return false;
+                }
+                data = &input;
+        }
+        CSha256 songDigest;
+        songDigest.update(data->data(), data->size());
+        const std::string header = cacheOptions(opts, data->size()) + songDigest.hex() + "\n";
+        CSha256 key;
+        key.update(header.data(), header.size());
+        const std::string name = key.hex().substr(0, 16);
+        const fs::path path = fs::path(opts.cacheDir) / name.substr(0, 2) / name;
+
+        std::vector<uint8_t> output;
+        std::vector<uint8_t> stored;
+        std::vector<uint8_t>::iterator samplesEnd;
+        unsigned long long numSamples;
+        if (readWhole(path.c_str(), stored) && stored.size() > header.size()
+                        && std::equal(header.begin(), header.end(), stored.begin())
+                        && (samplesEnd = std::find(stored.begin() + header.size(), stored.end(), '\n')) != stored.end()
+                        && sscanf(std::string(stored.begin() + header.size(), samplesEnd).c_str(),
+                                  "samples %llu", &numSamples) == 1) {
+                output.assign(samplesEnd + 1, stored.end());
+                if (stats) {
+                        stats->cacheHits++;
+                        stats->bytesOut += output.size();
+                }
+                if (opts.numSamples) {
+                        *opts.numSamples = numSamples;
+                }
+                LOG(opts, LogInfo, "%s is in the cache, %llu samples\n", infile, numSamples);
+        } else {
+                ConvertOptions mine = opts;
+                mine.songData = data;
+                mine.output = &output;
+                if (! convertSong(song, writer, infile, outfile, mine, error, stats)) {
+                        return false;
+                }
+                numSamples = writer.numSamples();
+                // written aside then renamed, other converters may be reading it;
+                // failing to store is only a miss next time
+                std::error_code ec;
+                fs::create_directories(path.parent_path(), ec);
+                fs::path part = path;
+                part += "." + std::to_string(getpid()) + "-"
+                        + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+                const std::string samplesLine = "samples " + std::to_string(numSamples) + "\n";
+                stored.assign(header.begin(), header.end());
+                stored.insert(stored.end(), samplesLine.begin(), samplesLine.end());
+                stored.insert(stored.end(), output.begin(), output.end());
+                if (writeWhole(part.c_str(), stored)) {
+                        fs::rename(part, path, ec);
+                }
+                fs::remove(part, ec);
+        }
+        if (opts.output) {
+                opts.output->swap(output);
+        } else if (! writeWhole(outfile, output)) {
+                error = std::string("Can't write ") + outfile;
+                return false;
+        }
+        return true;
+}
+
+// convertSong() (through the cache if there's one), timed and counted into stats unless it's NULL
+static bool convertFile(YMMUSIC * song, CPsymWriter & writer, const char * infile, const char * outfile,
+                        const ConvertOptions & opts, std::string & error, ConvertStats * stats) {
+        auto convert = (opts.cacheDir.size() && opts.format != FormatWAV) ? convertCached : convertSong;
+        if (! stats) {
+            return convert(song, writer, infile, outfile, opts, error, NULL);
+        }
+        ymMusicSetStats(song, &stats->load);
+        uint64_t start = nowNs();
+        bool ok = convert(song, writer, infile, outfile, opts, error, stats);
+        stats->totalNs += nowNs() - start;
+        stats->files++;
+        ymMusicSetStats(song, NULL);
+        return ok;
+}
+
+/*
+ * --stream: infile converted on a thread of its own, its frames pushed
+ * onto a ring that this one paces out to device as they play, see Stream.h.
+ */
+static bool streamSong(YMMUSIC * song, CPsymWriter & writer, const char * infile, const char * device,
+                        ConvertOptions opts, std::string & error, ConvertStats * stats) {
+        int fd = openStreamDevice(device, error);
+        if (fd < 0) {
+                return false;
+        }
+        CStreamRing ring;
+        opts.stream = &ring;
+        // a cached output would come in one piece
+        opts.cacheDir.clear();
+        bool converted = false;
+        std::string convertError;
+        const uint64_t started = nowNs();
+        std::thread producer([&] {
+                converted = convertFile(song, writer, infile, device, opts, convertError, stats);
+                // the trailer, or what there is of a conversion that failed
+                streamPush(ring, writer, 0, true);
+        });
+        StreamCounters counters = StreamCounters();
+        bool sent = streamFrames(fd, ring, started, counters);
+        producer.join();
+        if (fd != STDOUT_FILENO && close(fd) != 0) {
+                sent = false;
+        }
+        if (stats) {
+                stats->stream = counters;
+        }
+        LOG(opts, LogInfo, "streamed %llu frames to %s, %llu underruns\n", (unsigned long long)counters.frames,
+            device, (unsigned long long)counters.underruns);
+        if (! converted) {
+                error = convertError;
+                return false;
+        }
+        if (! sent) {
+                error = std::string("Can't write ") + device;
+                return false;
+        }
+        return true;
+}
+
+typedef struct {
+    std::filesystem::path infile;
+    std::filesystem::path outfile;
+    std::uintmax_t size;
+} BatchJob;
+
+/*
+ * Convert every .ym file found under indir into outdir (same relative layout),
+ * spread over numThreads workers.  Jobs are sorted biggest first and each worker
+ * grabs the next one when it is done with its current file, so a few long songs
+ * can't leave the other cores idle at the end.
+ */
+static int convertBatch(const char * indir, const char * outdir, unsigned numThreads,
+                        const ConvertOptions & opts) {
+        namespace fs = std::filesystem;
+        std::vector<BatchJob> jobs;
+        std::error_code ec;
+        
+        for (fs::recursive_directory_iterator it(indir, ec), end; !ec && it != end; it.increment(ec)) {
+                if (! it->is_regular_file()) {
+                        continue;
+                }
+                std::string ext = it->path().extension().string();
+                std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+                if (ext != ".ym") {
+                        continue;
+                }
+                BatchJob job;
+                job.infile = it->path();
+                job.outfile = fs::path(outdir) / fs::relative(it->path(), indir);
+                job.outfile.replace_extension(opts.format == FormatPython ? ".py" : opts.format == FormatWAV ? ".wav" : ".psym");
+                job.size = it->file_size();
+                jobs.push_back(job);
+        }
+        if (ec) {
+                std::cerr << "Can't read " << indir << ": " << ec.message() << std::endl;
+                return -2;
+        }
+        std::sort(jobs.begin(), jobs.end(),
+                  [](const BatchJob & a, const BatchJob & b) { return a.size > b.size; });
+        
+        if (numThreads < 1) {
+                numThreads = 1;
+        }
+        if (numThreads > jobs.size()) {
+                numThreads = jobs.size() ? jobs.size() : 1;
+        }
+        
+        // songs are created up front: the YM emulator constructor
+        // touches shared tables, so keep that out of the workers
+        std::vector<YMMUSIC *> songs;
+        for (unsigned t=0; t<numThreads; t++) {
+                songs.push_back(ymMusicCreateWithRate(opts.wavRate));
+        }
+        
+        std::atomic<std::size_t> next(0);
+        std::mutex failMutex;
+        std::vector<std::pair<std::string, std::string>> failures;
+        ConvertStats stats = ConvertStats();
+        auto start = std::chrono::steady_clock::now();
+        
+        // the workers' messages would only get mixed up, the summary says it all
+        ConvertOptions jobOpts = opts;
+        jobOpts.logLevel = LogQuiet;
+        
+        auto worker = [&](YMMUSIC * song) {
+                CPsymWriter * writer = newWriter(opts);
+                ConvertStats mine = ConvertStats();
+                std::size_t j;
+                while ((j = next++) < jobs.size()) {
+                        std::string error;
+                        std::error_code dirError;
+                        fs::create_directories(jobs[j].outfile.parent_path(), dirError);
+                        if (dirError) {
+                                error = "Can't create " + jobs[j].outfile.parent_path().string() + ": " + dirError.message();
                         }
-                        fs << "[";
-                        for (uint8_t j=0; j<s->num; j++) {
-                                if (j) {
-                                        fs << ",";
-                                }
-                                fs << "(" << (int)s->values[j].reg << "," <<(int) s->values[j].val << ")";
-                                reg_count ++;
+                        if (dirError || ! convertFile(song, *writer, jobs[j].infile.c_str(), jobs[j].outfile.c_str(), jobOpts, error,
+                                          opts.stats ? &mine : NULL)) {
+                                std::lock_guard<std::mutex> lock(failMutex);
+                                failures.push_back(std::make_pair(jobs[j].infile.string(), error));
                         }
-                        fs << "],";
-                        if (reg_count > 10) {
-                                reg_count = 0;
-                                fs << "\n";
+                }
+                delete writer;
+                std::lock_guard<std::mutex> lock(failMutex);
+                addStats(stats, mine);
+        };
+        
+        std::vector<std::thread> workers;
+        for (unsigned t=0; t<numThreads; t++) {
+                workers.push_back(std::thread(worker, songs[t]));
+        }
+        for (std::thread & w : workers) {
+                w.join();
+        }
+        
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        for (YMMUSIC * song : songs) {
+                ymMusicDestroy(song);
+        }
+        
+        for (auto & f : failures) {
+                std::cerr << "FAILED " << f.first << ": " << f.second << std::endl;
+        }
+        LOG(opts, LogInfo, "converted %zu/%zu files in %gs (%g files/s, %u threads), %zu failed\n",
+            jobs.size() - failures.size(), jobs.size(), elapsed,
+            elapsed > 0 ? jobs.size() / elapsed : 0, numThreads, failures.size());
+        if (opts.stats) {
+                printStats(stats, opts.stats);
+        }
+        
+        return failures.size() ? -3 : 0;
+}
+
+
+static void defaultOptions(ConvertOptions & opts) {
+        opts.format = FormatPSYM1;
+        opts.logLevel = LogInfo;
+        opts.clockFreq = CLOCK_FREQ_HZ;
+        opts.rateHz = SAMPLE_RATE_HZ;
+        opts.wavRate = WAV_RATE_HZ;
+        opts.renderThreads = 1;
+        opts.segmentSeconds = SEGMENT_SECONDS;
+        opts.skip_duplicates = false;
+        opts.waits = false;
+        opts.emulate = false;
+        opts.indexInterval = 0;
+        opts.repeats = false;
+        opts.loop = false;
+        opts.events = false;
+        opts.stats = StatsOff;
+        opts.songData = NULL;
+        opts.output = NULL;
+        opts.numSamples = NULL;
+        opts.cacheDir.clear();
+        opts.stream = NULL;
+        #ifdef SKIP_DUPS
+        opts.skip_duplicates = true;
+        #endif
+}
+
+// what the command line (or a --serve request) asks for besides the options
+typedef struct {
+    std::vector<std::string> args;      // whatever isn't an option: files, directories
+    bool batch;
+    unsigned numThreads;
+    std::string serve;                  // --serve: "-" for stdin, else a socket path
+    std::string stream;                 // --stream: the device, "-" for stdout
+} CommandLine;
+
+/*
+ * the options in argv (program name left out) into opts and line.
+ * On a bad one, returns false with the reason in error.
+ */
+static bool parseOptions(const std::vector<std::string> & argv, ConvertOptions & opts, CommandLine & line,
+                        std::string & error) {
+        const int argc = argv.size();
+        for (int i=0; i<argc; i++) {
+                const std::string & arg = argv[i];
+                if (arg == "-p") {
+                        opts.format = FormatPython;
+                } else if (arg == "-w") {
+                        opts.format = FormatWAV;
+                } else if (arg == "-r" && i + 1 < argc) {
+                        opts.wavRate = std::atoi(argv[++i].c_str());
+                } else if (arg == "--segment" && i + 1 < argc) {
+                        opts.segmentSeconds = std::atoi(argv[++i].c_str());
+                } else if (arg == "-f" && i + 1 < argc) {
+                        const std::string & format = argv[++i];
+                        if (format == "psym1") {
+                                opts.format = FormatPSYM1;
+                        } else if (format == "psym2") {
+                                opts.format = FormatPSYM2;
+                        } else if (format == "python") {
+                                opts.format = FormatPython;
+                        } else if (format == "wav") {
+                                opts.format = FormatWAV;
+                        } else {
+                                error = "Unknown format " + format + " (psym1, psym2, python or wav)";
+                                return false;
                         }
+                } else if (arg == "--emulate") {
+                        opts.emulate = true;
+                } else if (arg == "--wait") {
+                        opts.waits = true;
+                } else if (arg == "--index" && i + 1 < argc) {
+                        opts.indexInterval = std::atoi(argv[++i].c_str());
+                } else if (arg == "--compress") {
+                        opts.repeats = true;
+                } else if (arg == "--loop") {
+                        opts.loop = true;
+                } else if (arg == "--events") {
+                        opts.events = true;
+                } else if (arg == "--stats" || arg == "--stats=text") {
+                        opts.stats = StatsText;
+                } else if (arg == "--stats=json") {
+                        opts.stats = StatsJSON;
+                } else if (arg == "-q") {
+                        opts.logLevel = LogQuiet;
+                } else if (arg == "-v") {
+                        opts.logLevel = LogDebug;
+                } else if (arg == "--batch") {
+                        line.batch = true;
+                } else if (arg == "-j" && i + 1 < argc) {
+                        line.numThreads = std::atoi(argv[++i].c_str());
+                } else if (arg == "--cache" && i + 1 < argc) {
+                        opts.cacheDir = argv[++i];
+                } else if (arg == "--stream" && i + 1 < argc) {
+                        line.stream = argv[++i];
+                } else if (arg == "--serve") {
+                        line.serve = "-";
+                } else if (arg.compare(0, 8, "--serve=") == 0 && arg.size() > 8) {
+                        line.serve = arg.substr(8);
+                } else {
+                        line.args.push_back(arg);
                 }
-                fs << "]\n";
-                
+        }
+        return true;
+}
+
+// options that don't go together
+static bool checkOptions(const ConvertOptions & opts, std::string & error) {
+        if (opts.indexInterval && opts.format == FormatPSYM1) {
+            error = "PSYM1 has no index, use -f psym2";
+        } else if (opts.loop && opts.format == FormatPSYM1) {
+            error = "PSYM1 has no loop, use -f psym2";
+        } else if (opts.events && opts.format == FormatPSYM1) {
+            error = "PSYM1 has no events, use -f psym2";
+        } else if (opts.repeats && opts.format != FormatPSYM2) {
+            error = "Only PSYM2 has repeats, use -f psym2";
+        } else if (opts.wavRate < 1000 || opts.wavRate > 384000) {
+            error = "WAV sample rate " + std::to_string(opts.wavRate) + "Hz is out of range (1000 to 384000)";
         } else {
-                std::ofstream fs(outfile, std::ios::out | std::ios::binary);
-                fs << "PSYM1";
-                fs.write((char*)&clockFreq, sizeof(uint32_t));
-                fs << rateHz;
-                fs.write((char*)&(numsamps), sizeof(std::size_t));
-                
-                for (RegisterSettings * s : samples) {
-                        // std::cout << (int)s->num << std::endl;
-                        fs << s->num;
-                        for (uint8_t j=0; j<s->num; j++) {
-                                fs << s->values[j].reg;
-                                fs << s->values[j].val;
+            return true;
+        }
+        return false;
+}
+
+/*
+ * --serve: conversion requests (see Serve.h), one per line.  Each worker
+ * keeps its song instance and writers from one request to the next, the
+ * instance is only made again for another WAV rate.
+ */
+typedef struct {
+    YMMUSIC * song;
+    int songRate;
+    CPsymWriter * writers[FormatWAV];   // by format, made as needed
+} ServeWorker;
+
+// the YM emulator constructor touches shared tables, one at a time
+static std::mutex serveCreateMutex;
+
+static void serveWorkerSong(ServeWorker & worker, int wavRate) {
+        if (worker.song && worker.songRate == wavRate) {
+                return;
+        }
+        std::lock_guard<std::mutex> lock(serveCreateMutex);
+        if (worker.song) {
+                ymMusicDestroy(worker.song);
+        }
+        worker.song = ymMusicCreateWithRate(wavRate);
+        worker.songRate = wavRate;
+}
+
+static void serveWorkerEnd(ServeWorker & worker) {
+        for (CPsymWriter * writer : worker.writers) {
+                delete writer;
+        }
+        if (worker.song) {
+                ymMusicDestroy(worker.song);
+        }
+}
+
+// the reply line to one request line, options it doesn't give are defaults
+static std::string serveRequest(const std::string & text, const ConvertOptions & defaults, ServeWorker & worker) {
+        ServeRequest request;
+        ConvertOptions opts = defaults;
+        CommandLine line = CommandLine();
+        line.numThreads = 1;
+        std::string error;
+        bool ok = parseServeRequest(text, request, error)
+                        && parseOptions(request.args, opts, line, error) && checkOptions(opts, error);
+        if (ok && (line.args.size() || line.batch || line.serve.size() || line.stream.size())) {
+                error = "args only takes options, the song and output are in, data and out";
+                ok = false;
+        }
+        if (ok && opts.format == FormatWAV && request.out.empty()) {
+                error = "WAV output needs a file";
+                ok = false;
+        }
+        std::string reply = "{\"id\": " + request.id;
+        if (! ok) {
+                return reply + ", \"ok\": false, \"error\": " + jsonString(error) + "}\n";
+        }
+
+        // stdout may well be where the replies go
+        opts.logLevel = LogQuiet;
+        opts.renderThreads = std::max(1u, line.numThreads);
+        std::vector<uint8_t> output;
+        uint64_t numSamples = 0;
+        opts.songData = request.hasData ? &request.data : NULL;
+        opts.numSamples = &numSamples;
+        opts.output = request.out.empty() ? &output : NULL;
+        serveWorkerSong(worker, opts.wavRate);
+        // a WAV render doesn't use its writer, any will do
+        CPsymWriter * & writer = worker.writers[opts.format == FormatWAV ? FormatPSYM1 : opts.format];
+        if (! writer) {
+                writer = newFormatWriter(opts);
+        }
+        writer->setWaits(opts.waits);
+        writer->setIndex(opts.indexInterval);
+        writer->setRepeats(opts.repeats);
+        writer->setEvents(opts.events);
+        ConvertStats stats = ConvertStats();
+        ok = convertFile(worker.song, *writer, request.hasData ? "data" : request.in.c_str(),
+                         request.out.empty() ? "reply" : request.out.c_str(), opts, error, &stats);
+        // buffers kept for the next request, the song was request.data
+        ymMusicUnload(worker.song);
+        if (! ok) {
+                return reply + ", \"ok\": false, \"error\": " + jsonString(error) + "}\n";
+        }
+        reply += ", \"ok\": true";
+        if (request.out.empty()) {
+                reply += ", \"data\": \"" + base64Encode(output.data(), output.size()) + "\"";
+        } else {
+                reply += ", \"out\": " + jsonString(request.out);
+        }
+        if (opts.format != FormatWAV) {
+                reply += ", \"samples\": " + std::to_string(numSamples);
+        }
+        return reply + ", \"stats\": " + statsJSON(stats) + "}\n";
+}
+
+static bool writeAll(int fd, const std::string & text) {
+        return writeAll(fd, text.data(), text.size());
+}
+
+// requests read from in and answered in order on out, until in ends
+static void serveConnection(int in, int out, const ConvertOptions & defaults, ServeWorker & worker) {
+        std::string pending;
+        std::size_t scanned = 0;        // no end of line before that in pending
+        char buffer[64*1024];
+        for (;;) {
+                std::size_t start = 0;
+                std::size_t end;
+                while ((end = pending.find('\n', scanned)) != std::string::npos) {
+                        std::string text = pending.substr(start, end - start);
+                        start = scanned = end + 1;
+                        if (text.find_first_not_of(" \t\r") == std::string::npos) {
+                                continue;
+                        }
+                        if (! writeAll(out, serveRequest(text, defaults, worker))) {
+                                return;
                         }
                 }
-                fs.close();
+                pending.erase(0, start);
+                scanned = pending.size();
+                if (pending.size() > SERVE_LINE_MAX) {
+                        writeAll(out, "{\"id\": null, \"ok\": false, \"error\": \"request too long\"}\n");
+                        return;
+                }
+                ssize_t n = read(in, buffer, sizeof(buffer));
+                if (n < 0 && errno == EINTR) {
+                        continue;
+                }
+                if (n <= 0) {
+                        break;
+                }
+                pending.append(buffer, n);
+        }
+        // a last request without its end of line
+        if (pending.find_first_not_of(" \t\r") != std::string::npos) {
+                writeAll(out, serveRequest(pending, defaults, worker));
+        }
+}
+
+/*
+ * the requests on stdin, answered on stdout, or on every connection to a
+ * UNIX socket at path, numThreads connections at a time
+ */
+static int serve(const std::string & path, unsigned numThreads, const ConvertOptions & defaults) {
+        if (path == "-") {
+                ServeWorker worker = ServeWorker();
+                serveConnection(0, 1, defaults, worker);
+                serveWorkerEnd(worker);
+                return 0;
+        }
+
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) {
+                std::cerr << "Socket path " << path << " is too long" << std::endl;
+                return -2;
+        }
+        strcpy(addr.sun_path, path.c_str());
+        // one left by an earlier run
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+                unlink(path.c_str());
+        }
+        int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0
+                        || listen(listener, SERVE_BACKLOG) != 0) {
+                std::cerr << "Can't serve on " << path << ": " << strerror(errno) << std::endl;
+                return -2;
         }
+        // a client going away is only the end of its connection
+        signal(SIGPIPE, SIG_IGN);
+        if (numThreads < 1) {
+                numThreads = 1;
+        }
+        LOG(defaults, LogInfo, "serving on %s, %u connections at a time\n", path.c_str(), numThreads);
+        fflush(stdout);
+
+        std::vector<ServeWorker> workers(numThreads, ServeWorker());
+        std::vector<std::thread> threads;
+        for (unsigned t=0; t<numThreads; t++) {
+                serveWorkerSong(workers[t], defaults.wavRate);
+                threads.push_back(std::thread([&, t] {
+                        for (;;) {
+                                int connection = accept(listener, NULL, NULL);
+                                if (connection < 0) {
+                                        if (errno == EINTR || errno == ECONNABORTED) {
+                                                continue;
+                                        }
+                                        break;
+                                }
+                                serveConnection(connection, connection, defaults, workers[t]);
+                                close(connection);
+                        }
+                }));
+        }
+        for (std::thread & t : threads) {
+                t.join();
+        }
+        for (ServeWorker & worker : workers) {
+                serveWorkerEnd(worker);
+        }
+        close(listener);
+        std::cerr << "Can't accept on " << path << ": " << strerror(errno) << std::endl;
+        return -2;
+}
+
+
+int main(int argc, char* argv[]) {
+        ConvertOptions opts;
+        defaultOptions(opts);
+        CommandLine line = CommandLine();
+        line.numThreads = std::thread::hardware_concurrency();
+        std::string error;
+        if (! parseOptions(std::vector<std::string>(argv + 1, argv + argc), opts, line, error)) {
+                std::cerr << error << std::endl;
+                return -1;
+        }
+        const std::vector<std::string> & args = line.args;
         
+        if (args.size() != (line.serve.size() ? 0 : line.stream.size() ? 1 : 2)) {
+            std::cerr << "Usage: ymconvert [-p | -f FORMAT] [--wait] [--index N] [--compress] [--loop] [--emulate | --events] [-j N] FILE.ym OUTFILE" << std::endl;
+            std::cerr << "       ymconvert [-p | -f FORMAT] [--wait] [--index N] [--compress] [--loop] [--emulate | --events] --batch INDIR OUTDIR [-j N]" << std::endl;
+            std::cerr << "       ymconvert -w [-r RATE] [-j N] [--segment SECONDS] FILE.ym OUTFILE.wav (or --batch INDIR OUTDIR)" << std::endl;
+            std::cerr << "       ymconvert [-p | -f FORMAT] [--index N] [--loop] [--emulate | --events] [-j N] --stream DEVICE FILE.ym" << std::endl;
+            std::cerr << "       ymconvert --serve[=SOCKET] [-j N] [OPTIONS]" << std::endl;
+            std::cerr << "FORMAT is psym1 (default), psym2, python (same as -p) or wav (same as -w)" << std::endl;
+            std::cerr << "-r RATE is the WAV sample rate in Hz, 44100 by default" << std::endl;
+            std::cerr << "-j N renders a WAV, or captures --emulate and --events, in SECONDS long parts (10 by default) on N threads" << std::endl;
+            std::cerr << "--index N adds a keyframe every N frames (psym2 and python)" << std::endl;
+            std::cerr << "--compress replaces runs of entries seen before with a repeat of them (psym2)" << std::endl;
+            std::cerr << "--loop stores where the song loops to, to play it forever (psym2 and python)" << std::endl;
+            std::cerr << "-q prints nothing but errors, -v dumps every sample too" << std::endl;
+            std::cerr << "--stats (or --stats=json) reports the time spent in each phase and what was output, on stderr" << std::endl;
+            std::cerr << "--emulate captures the writes of the emulated player, rather than reading the YM stream" << std::endl;
+            std::cerr << "--events also captures SID, drums and sync buzzer as timed writes within frames (psym2 and python, -r sets their resolution)" << std::endl;
+            std::cerr << "--cache DIR keeps the converted files there, the same song with the same options is copied back rather than converted (not for WAV)" << std::endl;
+            std::cerr << "--stream plays FILE.ym out to DEVICE (- for stdout) while it's converted, a frame at a time as they play" << std::endl;
+            std::cerr << "--serve answers JSON lines conversion requests from stdin on stdout, or on a UNIX SOCKET (N connections at a time), OPTIONS are their defaults" << std::endl;
+            return -1;
+        }
+        if (! checkOptions(opts, error)) {
+            std::cerr << error << std::endl;
+            return -1;
+        }
         
-
+        if (line.stream.size()) {
+                if (line.batch || line.serve.size()) {
+                        error = "--stream plays a single song";
+                } else if (opts.format == FormatWAV) {
+                        error = "WAV can't be streamed";
+                } else if (opts.waits || opts.repeats) {
+                        error = "--stream can't --wait nor --compress, they hold frames back";
+                }
+                if (error.size()) {
+                        std::cerr << error << std::endl;
+                        return -1;
+                }
+        }
+        if (line.serve.size()) {
+                return serve(line.serve, line.numThreads, opts);
+        }
+        if (line.batch) {
+                return convertBatch(args[0].c_str(), args[1].c_str(), line.numThreads, opts);
+        }
+        
+        const std::string & out = line.stream.size() ? line.stream : args[1];
+        if (out == "-") {
+                if (opts.format == FormatWAV) {
+                        std::cerr << "WAV output needs a file" << std::endl;
+                        return -1;
+                }
+                // stdout is the output, keep it clean
+                opts.logLevel = LogQuiet;
+        } else if (opts.format == FormatPython) {
+                LOG(opts, LogInfo, "Pure python\n");
+        }
+        
+        opts.renderThreads = line.numThreads;
+        YMMUSIC * song = ymMusicCreateWithRate(opts.wavRate);
+        CPsymWriter * writer = newWriter(opts);
+        ConvertStats stats = ConvertStats();
+        bool ok = line.stream.size()
+                ? streamSong(song, *writer, args[0].c_str(), out.c_str(), opts, error, opts.stats ? &stats : NULL)
+                : convertFile(song, *writer, args[0].c_str(), out.c_str(), opts, error, opts.stats ? &stats : NULL);
+        delete writer;
+        ymMusicDestroy(song);
+        if (ok && opts.stats) {
+                printStats(stats, opts.stats);
+        }
+        if (! ok) {
+                std::cerr << "Can't convert " << args[0] << ": " << error << std::endl;
+                return -2;
+        }
         
         return 0;
         
-}
\ No newline at end of file
+}